@@ -0,0 +1,273 @@
+#include <string.h>
+#include <math.h>
+#include "rft_cc.h"
+
+#define CUBIC_C 0.4         // CUBIC scaling constant
+#define CUBIC_BETA 0.7      // CUBIC multiplicative decrease factor
+#define BBR_HIGH_GAIN 2.885 // BBR-lite STARTUP gain (2/ln 2)
+#define BBR_CYCLE_LEN 8     // phases of the PROBE_BW gain cycle
+
+/* BBR-lite modes */
+enum { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW };
+
+/* pacing gains of the PROBE_BW phases, each lasting one min RTT */
+static const double bbr_cycle_gain[BBR_CYCLE_LEN] =
+    { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/* keep cwnd between the given min and the send window */
+static void clamp_cwnd(cc_state_t* cc, double min) {
+    if (cc->cwnd < min)
+        cc->cwnd = min;
+    else if (cc->cwnd > cc->max_cwnd)
+        cc->cwnd = cc->max_cwnd;
+}
+
+/*
+ * pace window based controllers a little faster than cwnd per RTT, twice
+ * as fast in slow start (as Linux does)
+ */
+static void window_pacing_rate(cc_state_t* cc, long long srtt) {
+    if (srtt > 0)
+        cc->pacing_rate = (cc->cwnd < cc->ssthresh ? 2.0 : 1.2) * cc->cwnd *
+            cc->mss * 1e6 / srtt;
+}
+
+/*
+ * none - fixed window
+ */
+static void none_init(cc_state_t* cc) {
+    cc->cwnd = cc->max_cwnd;
+    cc->ssthresh = cc->max_cwnd;
+}
+
+static void none_on_ack(cc_state_t* cc, cc_sample_t* rs) {
+    window_pacing_rate(cc, rs->srtt);
+}
+
+static void none_on_loss(cc_state_t* cc, long long now) {
+    (void) cc;
+    (void) now;
+}
+
+/*
+ * reno - NewReno AIMD: slow start to ssthresh, then one segment per RTT,
+ * halved on loss (once per window of data, the sender's recovery point
+ * ensures that) and back to one segment on timeout
+ */
+static void reno_init(cc_state_t* cc) {
+    cc->cwnd = CC_INIT_CWND;
+    cc->ssthresh = cc->max_cwnd;
+    clamp_cwnd(cc, 1);
+}
+
+static void reno_on_ack(cc_state_t* cc, cc_sample_t* rs) {
+    if (cc->cwnd < cc->ssthresh)
+        cc->cwnd += rs->acked;
+    else
+        cc->cwnd += (double) rs->acked / cc->cwnd;
+
+    clamp_cwnd(cc, 1);
+    window_pacing_rate(cc, rs->srtt);
+}
+
+static void reno_on_loss(cc_state_t* cc, long long now) {
+    (void) now;
+
+    cc->ssthresh = cc->cwnd / 2 < CC_MIN_CWND ? CC_MIN_CWND : cc->cwnd / 2;
+    cc->cwnd = cc->ssthresh;
+    clamp_cwnd(cc, 1);
+}
+
+static void reno_on_timeout(cc_state_t* cc, long long now) {
+    reno_on_loss(cc, now);
+    cc->cwnd = 1;
+}
+
+/*
+ * cubic - CUBIC (RFC 8312): after a loss the window grows along a cubic
+ * function of the time since the loss, flat around the window at the loss
+ * and steep away from it, but at least as fast as Reno would
+ */
+static void cubic_init(cc_state_t* cc) {
+    reno_init(cc);
+    cc->w_max = 0;
+    cc->epoch_start = 0;
+}
+
+static void cubic_on_ack(cc_state_t* cc, cc_sample_t* rs) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += rs->acked;
+    } else {
+        if (!cc->epoch_start) {
+            cc->epoch_start = rs->now;
+            cc->w_est = cc->cwnd;
+
+            if (cc->cwnd < cc->w_max) {
+                cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+                cc->w_origin = cc->w_max;
+            } else {
+                cc->k = 0;
+                cc->w_origin = cc->cwnd;
+            }
+        }
+
+        /* target one RTT ahead */
+        double t = (rs->now - cc->epoch_start + rs->srtt) / 1e6;
+        double target = cc->w_origin + CUBIC_C * pow(t - cc->k, 3);
+
+        if (target > cc->cwnd)
+            cc->cwnd += rs->acked * (target - cc->cwnd) / cc->cwnd;
+        else
+            cc->cwnd += rs->acked * 0.01 / cc->cwnd;
+
+        cc->w_est += rs->acked * 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) /
+            cc->cwnd;
+
+        if (cc->w_est > cc->cwnd)
+            cc->cwnd = cc->w_est;
+    }
+
+    clamp_cwnd(cc, 1);
+    window_pacing_rate(cc, rs->srtt);
+}
+
+static void cubic_on_loss(cc_state_t* cc, long long now) {
+    (void) now;
+
+    /* fast convergence: release bandwidth to newer flows */
+    if (cc->cwnd < cc->w_max)
+        cc->w_max = cc->cwnd * (1 + CUBIC_BETA) / 2;
+    else
+        cc->w_max = cc->cwnd;
+
+    cc->epoch_start = 0;
+    cc->cwnd *= CUBIC_BETA;
+    clamp_cwnd(cc, CC_MIN_CWND);
+    cc->ssthresh = cc->cwnd;
+}
+
+static void cubic_on_timeout(cc_state_t* cc, long long now) {
+    cubic_on_loss(cc, now);
+    cc->cwnd = 1;
+}
+
+/*
+ * bbr - BBR-lite: models the path by its bottleneck bandwidth (max delivery
+ * rate over the last CC_BW_ROUNDS round trips) and min RTT, paces at a
+ * multiple of the bandwidth and keeps about two bandwidth-delay products
+ * in flight. It ignores isolated losses. STARTUP doubles the rate each
+ * round until the bandwidth stops growing, DRAIN empties the queue that
+ * built up, and PROBE_BW cycles the pacing gain around 1 to probe for
+ * more bandwidth. The PROBE_RTT mode of BBR is left out.
+ */
+static void bbr_init(cc_state_t* cc) {
+    cc->cwnd = CC_INIT_CWND;
+    cc->ssthresh = cc->max_cwnd;
+    clamp_cwnd(cc, 1);
+    cc->mode = BBR_STARTUP;
+    cc->pacing_gain = BBR_HIGH_GAIN;
+    cc->cwnd_gain = BBR_HIGH_GAIN;
+    memset(cc->bw, 0, sizeof(cc->bw));
+    cc->btl_bw = 0;
+    cc->min_rtt = 0;
+    cc->round = 0;
+    cc->next_round_delivered = 0;
+    cc->full_bw = 0;
+    cc->full_bw_rounds = 0;
+}
+
+static void bbr_on_ack(cc_state_t* cc, cc_sample_t* rs) {
+    bool round_start = false;
+
+    /* a round trip ends when a segment sent after it started is ACKed */
+    if (rs->prior_delivered >= cc->next_round_delivered) {
+        cc->next_round_delivered = rs->delivered;
+        cc->round++;
+        cc->bw[cc->round % CC_BW_ROUNDS] = 0;
+        round_start = true;
+    }
+
+    if (rs->delivery_rate > cc->bw[cc->round % CC_BW_ROUNDS])
+        cc->bw[cc->round % CC_BW_ROUNDS] = rs->delivery_rate;
+
+    cc->btl_bw = 0;
+
+    for (int i = 0; i < CC_BW_ROUNDS; i++) {
+        if (cc->bw[i] > cc->btl_bw)
+            cc->btl_bw = cc->bw[i];
+    }
+
+    if (rs->rtt > 0 && (!cc->min_rtt || rs->rtt <= cc->min_rtt ||
+            rs->now - cc->min_rtt_stamp > CC_MIN_RTT_USEC)) {
+        cc->min_rtt = rs->rtt;
+        cc->min_rtt_stamp = rs->now;
+    }
+
+    /* the pipe is full when the bandwidth grew < 25% in 3 rounds */
+    if (cc->mode == BBR_STARTUP && round_start) {
+        if (cc->btl_bw >= cc->full_bw * 1.25) {
+            cc->full_bw = cc->btl_bw;
+            cc->full_bw_rounds = 0;
+        } else if (++cc->full_bw_rounds >= 3) {
+            cc->mode = BBR_DRAIN;
+            cc->pacing_gain = 1 / BBR_HIGH_GAIN;
+        }
+    }
+
+    double bdp = cc->btl_bw * cc->min_rtt / 1e6;
+
+    if (cc->mode == BBR_DRAIN && rs->inflight <= bdp) {
+        cc->mode = BBR_PROBE_BW;
+        cc->cwnd_gain = 2;
+        cc->cycle = 0;
+        cc->cycle_stamp = rs->now;
+    }
+
+    if (cc->mode == BBR_PROBE_BW) {
+        if (rs->now - cc->cycle_stamp > cc->min_rtt) {
+            cc->cycle = (cc->cycle + 1) % BBR_CYCLE_LEN;
+            cc->cycle_stamp = rs->now;
+        }
+
+        cc->pacing_gain = bbr_cycle_gain[cc->cycle];
+    }
+
+    if (cc->btl_bw > 0 && cc->min_rtt > 0) {
+        cc->cwnd = cc->cwnd_gain * bdp;
+        cc->pacing_rate = cc->pacing_gain * cc->btl_bw * cc->mss;
+    } else if (cc->mode == BBR_STARTUP) {
+        cc->cwnd += rs->acked;
+    }
+
+    clamp_cwnd(cc, 2 * CC_MIN_CWND);
+}
+
+static void bbr_on_timeout(cc_state_t* cc, long long now) {
+    (void) now;
+
+    /* restart from a small window, the model is kept */
+    cc->cwnd = 2 * CC_MIN_CWND;
+}
+
+static cc_ops_t cc_algs[] = {
+    { "none", none_init, none_on_ack, none_on_loss, none_on_loss },
+    { "reno", reno_init, reno_on_ack, reno_on_loss, reno_on_timeout },
+    { "cubic", cubic_init, cubic_on_ack, cubic_on_loss, cubic_on_timeout },
+    { "bbr", bbr_init, bbr_on_ack, none_on_loss, bbr_on_timeout },
+};
+
+cc_ops_t* cc_find(char* name) {
+    for (size_t i = 0; i < sizeof(cc_algs) / sizeof(cc_algs[0]); i++) {
+        if (!strcmp(cc_algs[i].name, name))
+            return &cc_algs[i];
+    }
+
+    return NULL;
+}
+
+void cc_init(cc_state_t* cc, cc_ops_t* ops, int max_cwnd, int mss) {
+    memset(cc, 0, sizeof(cc_state_t));
+    cc->max_cwnd = max_cwnd;
+    cc->mss = mss;
+    ops->init(cc);
+}
@@ -0,0 +1,97 @@
+#ifndef _RFT_CC_H
+#define _RFT_CC_H
+#include <stdbool.h>
+
+/*
+ * Congestion control for the client's send window (wt transfer mode).
+ *
+ * The sender asks the controller how many segments it may keep in flight
+ * (cwnd) and at which rate to send them (pacing_rate). It reports every
+ * ACK, every loss detected from a selective ACK and every timeout to the
+ * controller, which adjusts its window accordingly. Controllers are
+ * selected by name with cc_find.
+ */
+
+#define CC_INIT_CWND 10     // congestion window before the first ACK
+#define CC_MIN_CWND 2       // min congestion window after a loss
+#define CC_BW_ROUNDS 10     // rounds (RTTs) the BBR-lite bottleneck
+                            // bandwidth estimate is the max over
+#define CC_MIN_RTT_USEC 10000000
+                            // time the BBR-lite min RTT estimate is valid
+
+/* sample of the transfer reported to the controller on each ACK */
+typedef struct cc_sample {
+    int acked;                  // segments newly ACKed by the ACK
+    int inflight;               // segments sent and not ACKed after the ACK
+    long delivered;             // segments ACKed so far in the transfer
+    long prior_delivered;       // segments ACKed when the most recently
+                                // sent of the newly ACKed segments was sent
+    double delivery_rate;       // segments/sec delivered over the interval
+                                // that segment was in flight, 0 if unknown
+    long long rtt;              // RTT measured by the ACK (usec), 0 if none
+    long long srtt;             // smoothed RTT of the sender (usec)
+    long long now;              // time of the ACK (usec)
+} cc_sample_t;
+
+/* state of a congestion controller */
+typedef struct cc_state {
+    double cwnd;                // congestion window (segments)
+    double ssthresh;            // slow start threshold (segments)
+    double pacing_rate;         // rate to send at (bytes/sec), 0 until known
+    int max_cwnd;               // upper limit of cwnd (the send window)
+    int mss;                    // payload bytes per segment
+
+    /* CUBIC */
+    double w_max;               // window before the last reduction
+    double w_origin;            // origin of the cubic function
+    double w_est;               // Reno-friendly window estimate
+    double k;                   // time (sec) to grow back to w_origin
+    long long epoch_start;      // start of the congestion avoidance epoch
+
+    /* BBR-lite */
+    int mode;                   // STARTUP, DRAIN or PROBE_BW
+    double bw[CC_BW_ROUNDS];    // max delivery rate (segments/sec) by round
+    double btl_bw;              // bottleneck bandwidth estimate
+    long long min_rtt;          // min RTT estimate (usec), 0 until sampled
+    long long min_rtt_stamp;    // time min_rtt was measured
+    long round;                 // round trips counted so far
+    long next_round_delivered;  // delivered count that ends the round
+    double full_bw;             // bandwidth at the last significant growth
+    int full_bw_rounds;         // rounds without significant growth
+    int cycle;                  // index into the PROBE_BW gain cycle
+    long long cycle_stamp;      // start of the current gain cycle phase
+    double pacing_gain;         // multiple of btl_bw to pace at
+    double cwnd_gain;           // multiple of the BDP to allow in flight
+} cc_state_t;
+
+/* a congestion control algorithm */
+typedef struct cc_ops {
+    char* name;
+    void (*init)(cc_state_t* cc);
+    void (*on_ack)(cc_state_t* cc, cc_sample_t* rs);
+    void (*on_loss)(cc_state_t* cc, long long now);    // once per window
+    void (*on_timeout)(cc_state_t* cc, long long now);
+} cc_ops_t;
+
+/*
+ * cc_find - find a congestion control algorithm by name: "reno" (NewReno
+ *      AIMD), "cubic" (CUBIC), "bbr" (model based BBR-lite) or "none"
+ *      (cwnd fixed at the send window)
+ *
+ * Return:
+ * The algorithm or NULL if there is no algorithm with the name
+ */
+cc_ops_t* cc_find(char* name);
+
+/*
+ * cc_init - initialise the state of a congestion controller
+ *
+ * Parameters:
+ * cc - the state to initialise
+ * ops - the algorithm
+ * max_cwnd - the send window, upper limit of the congestion window
+ * mss - the payload bytes per segment
+ */
+void cc_init(cc_state_t* cc, cc_ops_t* ops, int max_cwnd, int mss);
+
+#endif
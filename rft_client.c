@@ -10,7 +10,6 @@
 
 /*
  * This file contains the main function for the client.
- * Do NOT change anything in this file.
  * 
  * For a usage message for the client type:
  * 
@@ -21,17 +20,73 @@
  * Or start server as:
  *
  *      rft_client <input_file> <output_file> <server_addr> <port> 
- *                  <nm|wt loss_probability>  
+ *                  <nm|wt loss_probability> [-w window] [-s payload_size]
+ *                  [-c reno|cubic|bbr|none] [-b burst] [-g pacing_gain]
+ *                  [-m batch] [-o on|off] [-r read|mmap] [-z on|off]
+ *                  [-p streams] [-l range_size] [-i sum|crc32c|xxhash]
+ *                  [-f off|auto|k] [-x on|off] [-d on|off] [-j on|off]
  *
  * Where:
- *      input_file is the file to send
- *      output_file is name for the file on the server
+ *      input_file is the file to send, or a directory to send with all 
+ *          files and directories in it
+ *      output_file is name for the file (or directory) on the server
  *      server_addr is the address of the server
  *      port is the port the server is listening on
  *      nm selects normal transfer mode
  *      wt selects transfer with time out and a probability of loss or 
  *          corruption of segments. The probability must be between 0.0 and 1.0,
  *          inclusive.
+ *      -w window optionally sets the number of segments the wt transfer mode
+ *          keeps in flight without an ACK (1 to WINDOW_MAX, default
+ *          WINDOW_SIZE)
+ *      -s payload_size optionally sets the payload size of data segments to
+ *          propose to the server (PAYLOAD_SIZE to PAYLOAD_SIZE_MAX, default
+ *          PAYLOAD_SIZE_DEFAULT). The server may agree to a smaller size.
+ *      -c optionally selects the congestion control of the wt transfer mode:
+ *          reno (NewReno AIMD), cubic (CUBIC, the default), bbr (BBR-lite, 
+ *          model based) or none (the window is always the -w window)
+ *      -b burst optionally sets the number of segments the wt transfer mode
+ *          sends back to back before pacing them (1 to WINDOW_MAX, default
+ *          PACE_BURST_DEFAULT)
+ *      -g pacing_gain optionally sets the multiple of the congestion control
+ *          pacing rate the wt transfer mode paces segments at (default 1.0,
+ *          0 sends segments as fast as the window allows)
+ *      -m batch optionally sets the max number of segments the wt transfer
+ *          mode sends with one system call (1 to BATCH_MAX, default 
+ *          BATCH_SIZE)
+ *      -o optionally turns UDP segmentation offload (GSO) of the wt transfer
+ *          mode on (the default, used where the kernel supports it) or off
+ *      -r optionally selects how the input file is read: chunk by chunk as
+ *          segments are sent (read, the default) or copied from a mapping 
+ *          of the file (mmap). The wt transfer mode sends segments straight
+ *          from the mapping without copying their payload
+ *      -z optionally turns MSG_ZEROCOPY sends from the mapping of the input
+ *          file in wt transfer mode (-r mmap) on or off (the default)
+ *      -p streams optionally sets the number of ranges of the file sent at
+ *          the same time, each over a socket and session of its own (1 to 
+ *          STREAMS_MAX, default 1)
+ *      -l range_size optionally sets the bytes per range sent by a stream
+ *          (default: the file size divided by the number of streams)
+ *      -i optionally selects the checksum of data segments to propose to
+ *          the server: sum (sum of the payload bytes), crc32c (CRC32C of 
+ *          header and payload, the default) or xxhash (xxHash64 of header
+ *          and payload)
+ *      -f optionally sends a parity segment after each block of data 
+ *          segments in wt transfer mode, from which the server recovers a 
+ *          segment lost in the block without a resend: off (the default),
+ *          auto (the block size follows the loss rate) or k segments per 
+ *          block (FEC_K_MIN to FEC_K_MAX)
+ *      -x optionally compresses the payload of each data segment that 
+ *          shrinks, on or off (the default); the client stops trying on 
+ *          data that does not compress and tries again now and then
+ *      -d optionally sends a delta against the copy of the file the server
+ *          already has (output_file), on or off (the default): only the 
+ *          parts of the file that are not blocks of the copy are sent, the
+ *          file is sent itself if the server has no copy
+ *      -j optionally makes the transfer resumable, on or off (the default):
+ *          the server keeps a journal of the bytes of the file on disk and,
+ *          if a transfer of the same version of the file was cut off, only
+ *          the ranges of the file the server does not have are sent
  *
  * Only specify one transfer mode. That is, either nm or wt with a loss 
  * probability.      
@@ -45,29 +100,83 @@ typedef enum {
 } tfr_mode;
 
 #define TMODE_S_SIZE 3      // size of transfer mode command line arg
+#define CC_DEFAULT "cubic"  // congestion control unless set with -c
+#define PACE_BURST_DEFAULT 4    // pacer burst unless set with -b
+#define PACE_GAIN_DEFAULT 1.0   // pacing gain unless set with -g
+#define STREAMS_MAX 64      // max streams set with -p
+#define CSUM_DEFAULT "crc32c"   // checksum unless set with -i
 static char* tmode_s[] = { "un", "nm", "wt" };  // transfer mode args
 
 /* helper function to process command line arguments */
 static void process_argv(char* input_file, char* output_file, int port, 
     int argc, char** argv, tfr_mode* tmode, float* loss_prob, 
+    tfr_opts_t* opts, char* inf_msg_buf);
+
+/* helper function to process the options following the transfer mode */
+static void process_opts(int first, int argc, char** argv, tfr_opts_t* opts,
     char* inf_msg_buf);
 
+/* helper function to identify the version of the input file */
+static uint64_t file_source(struct stat* sbuf);
+
 /* helper function to end session, output success message and close resources */
 static void exit_success(char* inf_msg_buf, off_t fsize, char* input_file,
-    size_t bytes, int infd, int sockfd);
+    size_t bytes, int infd, int sockfd, tfr_opts_t* opts);
     
 /* the main function and entry point for rft_client */
 int main(int argc,char *argv[]) {
     if (argc < 6) {
         printf("usage: %s <input_file> <output_file> <server_addr> <port>"
-            " <nm|wt loss_probability>\n", argv[0]);
-        printf("       input_file is the file to send\n");
-        printf("       output_file is name for the file on the server\n");
+            " <nm|wt loss_probability> [-w window] [-s payload_size]"
+            " [-c reno|cubic|bbr|none] [-b burst] [-g pacing_gain]"
+            " [-m batch] [-o on|off] [-r read|mmap] [-z on|off]"
+            " [-p streams] [-l range_size] [-i sum|crc32c|xxhash]"
+            " [-f off|auto|k] [-x on|off] [-d on|off] [-j on|off]\n",
+            argv[0]);
+        printf("       input_file is the file or directory to send\n");
+        printf("       output_file is name for the file or directory on"
+            " the server\n");
         printf("       server_addr is the address of the server\n");
         printf("       port is the port the server is listening on\n");
         printf("       nm selects normal transfer, or:\n");
         printf("       wt selects transfer with time out \n");
         printf("          and a probability of loss between 0.0 and 1.0\n");
+        printf("       -w sets the number of segments in flight in wt mode\n");
+        printf("          (1 to %d, default %d)\n", WINDOW_MAX, WINDOW_SIZE);
+        printf("       -s sets the payload size of segments to propose\n");
+        printf("          (%d to %d, default %d)\n", PAYLOAD_SIZE, 
+            PAYLOAD_SIZE_MAX, PAYLOAD_SIZE_DEFAULT);
+        printf("       -c selects the congestion control in wt mode\n");
+        printf("          (default %s)\n", CC_DEFAULT);
+        printf("       -b sets the segments sent back to back in wt mode\n");
+        printf("          (1 to %d, default %d)\n", WINDOW_MAX, 
+            PACE_BURST_DEFAULT);
+        printf("       -g sets the multiple of the pacing rate in wt mode\n");
+        printf("          (default %.1f, 0 disables pacing)\n", 
+            PACE_GAIN_DEFAULT);
+        printf("       -m sets the segments sent per system call in wt mode\n");
+        printf("          (1 to %d, default %d)\n", BATCH_MAX, BATCH_SIZE);
+        printf("       -o turns UDP segmentation offload in wt mode on/off\n");
+        printf("          (default on)\n");
+        printf("       -r reads the input file with read or mmap\n");
+        printf("          (default read)\n");
+        printf("       -z turns MSG_ZEROCOPY sends on/off in wt mode\n");
+        printf("          with -r mmap (default off)\n");
+        printf("       -p sets the number of ranges sent at the same time\n");
+        printf("          (1 to %d, default 1)\n", STREAMS_MAX);
+        printf("       -l sets the bytes per range\n");
+        printf("          (default: file size / streams)\n");
+        printf("       -i selects the checksum of data segments\n");
+        printf("          (default %s)\n", CSUM_DEFAULT);
+        printf("       -f sends parity segments in wt mode, off, auto or\n");
+        printf("          segments per parity segment (%d to %d, default off)\n",
+            FEC_K_MIN, FEC_K_MAX);
+        printf("       -x turns compression of segment payloads on/off\n");
+        printf("          (default off)\n");
+        printf("       -d turns delta transfer against the server's copy\n");
+        printf("          of the file on/off (default off)\n");
+        printf("       -j turns resuming a transfer that was cut off\n");
+        printf("          on/off (default off)\n");
         exit(EXIT_FAILURE);
     }
 
@@ -78,12 +187,23 @@ int main(int argc,char *argv[]) {
     
     tfr_mode tmode = UNKNOWN_TFR_MODE;
     float loss_prob = 0.0;
+    tfr_opts_t opts = { .window = WINDOW_SIZE, 
+        .payload_size = PAYLOAD_SIZE_DEFAULT, .cc = cc_find(CC_DEFAULT),
+        .pace_burst = PACE_BURST_DEFAULT, .pace_gain = PACE_GAIN_DEFAULT,
+        .batch = BATCH_SIZE, .gso = true, .use_mmap = false, 
+        .zerocopy = false, .streams = 1, .range_size = 0, .tree = NULL, 
+        .csum = csum_find(CSUM_DEFAULT), .fec = 0,
+        .compress = false, .delta = false, .script = NULL, 
+        .resume = false, .source = 0, .missing = NULL, .nmissing = 0,
+        .ack_every = 1 };
     char inf_msg_buf[INF_MSG_SIZE];  // to construct info messages    
     
     process_argv(input_file, output_file, port, argc, argv, &tmode, &loss_prob,
-        inf_msg_buf);
+        &opts, inf_msg_buf);
 
     srand((unsigned) time(NULL));    // seed PRNG for is_corrupted function
+    
+    opts.session = new_session_id();
       
     /* try opening input file */
     int infd = open(input_file, O_RDONLY);
@@ -100,13 +220,101 @@ int main(int argc,char *argv[]) {
         exit_cerr(__LINE__, "Could not stat input file");
         
     off_t fsize = sbuf.st_size;
+    tree_t tree;
         
     print_sep();
-    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+    
+    /* 
+     * a directory is sent as the stream of its tree, the manifest and then
+     * the content of all files, in one session
+     */
+    if (S_ISDIR(sbuf.st_mode)) {
+        if (opts.streams > 1 || opts.range_size) {
+            errno = EINVAL;
+            exit_cerr(__LINE__, "Parallel streams only send a file");
+        }
+        
+        if (opts.delta) {
+            errno = EINVAL;
+            exit_cerr(__LINE__, "Delta transfer only sends a file");
+        }
+        
+        if (opts.resume) {
+            errno = EINVAL;
+            exit_cerr(__LINE__, "Resumable transfer only sends a file");
+        }
+        
+        if (!tree_scan(&tree, infd))
+            exit_cerr(__LINE__, "Could not read input directory");
+        
+        opts.tree = &tree;
+        fsize = tree.manifest_bytes + tree.bytes;
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Opened directory: %s, %d files in %d directories, %ld bytes, "
+            "manifest: %zu bytes", input_file, tree.files, tree.dirs, 
+            (long) tree.bytes, tree.manifest_bytes);
+        print_cmsg(inf_msg_buf);
+        
+        if (tree.skipped) {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, 
+                "%ld entries that are not files or directories skipped",
+                tree.skipped);
+            print_cmsg(inf_msg_buf);
+        }
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
             "Opened file: %s, size: %ld bytes", input_file, (long) fsize);
-    print_cmsg(inf_msg_buf);
+        print_cmsg(inf_msg_buf);
+    }
+    
     print_sep();
     print_sep();
+    
+    size_t bytes = 0;
+    
+    if (opts.delta && (opts.streams > 1 || opts.range_size)) {
+        errno = EINVAL;
+        exit_cerr(__LINE__, "Delta transfer sends a file over one stream");
+    }
+    
+    if (opts.delta && opts.resume) {
+        errno = EINVAL;
+        exit_cerr(__LINE__, "Delta transfer cannot be resumed");
+    }
+    
+    /* 
+     * a transfer of the same version of the file that was cut off is 
+     * resumed by sending the ranges the server does not have
+     */
+    journal_range_t missing[RESUME_RANGES_MAX + 1];
+    
+    if (opts.resume && fsize) {
+        opts.source = file_source(&sbuf);
+        opts.nmissing = resume_ranges(server_addr, port, fsize, output_file,
+            &opts, missing);
+        
+        if (!opts.nmissing) {
+            print_cmsg("Server has all of the file on disk, nothing to send");
+            exit_success(inf_msg_buf, fsize, input_file, bytes, infd, -1, 
+                &opts);
+        }
+        
+        if (opts.nmissing > 0) {
+            opts.missing = missing;
+            bytes = send_file_parallel(server_addr, port, infd, fsize, 
+                output_file, tmode == WT_TFR_MODE, loss_prob, &opts);
+            exit_success(inf_msg_buf, fsize, input_file, bytes, infd, -1, 
+                &opts);
+        }
+    }
+    
+    /* send ranges of the file over parallel streams */
+    if (fsize && (opts.streams > 1 || (opts.range_size && 
+            opts.range_size < (size_t) fsize))) {
+        bytes = send_file_parallel(server_addr, port, infd, fsize, 
+            output_file, tmode == WT_TFR_MODE, loss_prob, &opts);
+        exit_success(inf_msg_buf, fsize, input_file, bytes, infd, -1, &opts);
+    }
 
     /* create a UDP socket and assign all server information */
     struct sockaddr_in server;
@@ -117,41 +325,95 @@ int main(int argc,char *argv[]) {
         exit(EXIT_FAILURE);
     }
     
+    /* the file is one range */
+    opts.range_offset = 0;
+    opts.range_bytes = fsize;
+    
+    /* 
+     * the script of a delta against the server's copy of the file is sent
+     * in place of the file
+     */
+    delta_t delta;
+    off_t send_bytes = fsize;
+    
+    if (opts.delta && fsize && 
+            make_delta(&server, infd, fsize, output_file, &opts, &delta)) {
+        close(infd);
+        infd = delta.fd;
+        opts.script = &delta;
+        opts.range_bytes = send_bytes = delta.bytes;
+    }
+    
     print_cmsg("Prepared for transfer, sending meta data"); 
      
     /* Send meta data to the server */
-    if (!send_metadata(sockfd, &server, fsize, output_file)) {
+
+    if (!send_metadata(sockfd, &server, fsize, output_file, &opts)) {
         close(infd);
         exit_cerr(__LINE__, "Sending meta data failed");
     }
     
-    size_t bytes = 0;
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Server agreed to payload size: %d bytes", opts.payload_size);
+    print_cmsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Server agreed to segment checksum: %s (%s)", 
+            csum_name(opts.csum), csum_impl(opts.csum));
+    print_cmsg(inf_msg_buf);
+
+    if (opts.compress)
+        print_cmsg("Server agreed to compression of segment payloads");
+
+    if (opts.script)
+        print_cmsg("Server agreed to rebuild the file from the delta");
+
+    if (opts.source)
+        print_cmsg("Server agreed to keep a journal to resume the transfer");
+
+    if (opts.ack_every > 1) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Server agreed to ACK up to %d data segments at once", 
+            opts.ack_every);
+        print_cmsg(inf_msg_buf);
+    }
 
     if (!fsize) 
-        exit_success(inf_msg_buf, fsize, input_file, bytes, infd, sockfd);
+        exit_success(inf_msg_buf, fsize, input_file, bytes, infd, sockfd,
+            &opts);
+    
+    /* use the largest payload size that is not fragmented on the path */
+    probe_payload_size(sockfd, &server, &opts);
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Path MTU allows payload size: %d bytes", opts.payload_size);
+    print_cmsg(inf_msg_buf);
+    print_cmsg("Start sending file");
+    print_sep();
+    print_sep();
      
     switch (tmode) {
         case NM_TFR_MODE:
-            bytes = send_file_normal(sockfd, &server, infd, fsize);
+            bytes = send_file_normal(sockfd, &server, infd, send_bytes, 
+                &opts);
             snprintf(inf_msg_buf, INF_MSG_SIZE,
                      "%zu bytes",
                      bytes);
             print_cmsg(inf_msg_buf);
             break;
         case WT_TFR_MODE:
-            bytes = send_file_with_timeout(sockfd, &server, infd, fsize,
-                        loss_prob);
+            bytes = send_file_with_timeout(sockfd, &server, infd, 
+                        send_bytes, loss_prob, &opts);
             break;
         default: 
             errno = EINVAL;
             exit_cerr(__LINE__, "Unknown transfer mode");
     }
 
-    exit_success(inf_msg_buf, fsize, input_file, bytes, infd, sockfd);
+    exit_success(inf_msg_buf, fsize, input_file, bytes, infd, sockfd, &opts);
 } 
 
 static void exit_success(char* inf_msg_buf, off_t fsize, char* input_file, 
-    size_t bytes, int infd, int sockfd) {
+    size_t bytes, int infd, int sockfd, tfr_opts_t* opts) {
     if (!fsize) {
         snprintf(inf_msg_buf, INF_MSG_SIZE, 
             "Input file: %s is empty (0 bytes)", input_file); 
@@ -163,6 +425,10 @@ static void exit_success(char* inf_msg_buf, off_t fsize, char* input_file,
             "%zu bytes sent for transfer of file: %s of size: %ld",
             bytes, input_file, (long) fsize);
         print_cmsg(inf_msg_buf);
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Segment payload size: %d bytes (datagram size: %zu bytes)",
+            opts->payload_size, sizeof(segment_t) + opts->payload_size);
+        print_cmsg(inf_msg_buf);
     }
     
     print_sep();
@@ -177,9 +443,25 @@ static void exit_success(char* inf_msg_buf, off_t fsize, char* input_file,
     exit(EXIT_SUCCESS);
 }
 
+static uint64_t file_source(struct stat* sbuf) {
+    /* a new version of the file has a new size or time of last change */
+    struct {
+        uint64_t dev;
+        uint64_t ino;
+        int64_t size;
+        int64_t sec;
+        int64_t nsec;
+    } version = { sbuf->st_dev, sbuf->st_ino, sbuf->st_size, 
+        sbuf->st_mtim.tv_sec, sbuf->st_mtim.tv_nsec };
+    uint64_t source = xxh64(&version, sizeof(version), 0);
+    
+    /* 0 is no journal */
+    return source ? source : 1;
+}
+
 static void process_argv(char* input_file, char* output_file, int port, 
     int argc, char** argv, tfr_mode* tmode, float* loss_prob, 
-    char* inf_msg_buf) {
+    tfr_opts_t* opts, char* inf_msg_buf) {
     
     if (strnlen(input_file, FILE_NAME_SIZE) == FILE_NAME_SIZE) {
         errno = EINVAL;
@@ -201,13 +483,26 @@ static void process_argv(char* input_file, char* output_file, int port,
         exit_cerr(__LINE__, "Port is outside valid range");
     }
     
-    if (!strncmp(argv[5], tmode_s[NM_TFR_MODE], TMODE_S_SIZE) && argc == 6) {
+    if (!strncmp(argv[5], tmode_s[NM_TFR_MODE], TMODE_S_SIZE) && argc >= 6) {
         *tmode = NM_TFR_MODE;
+        process_opts(6, argc, argv, opts, inf_msg_buf);
+        
+        /* one segment at a time is never worth a parity segment */
+        opts->fec = 0;
+        
+        /* and each segment waits for its ACK */
+        opts->ack_every = 1;
     }
     
-    if (!strncmp(argv[5], tmode_s[WT_TFR_MODE], TMODE_S_SIZE) && argc == 7) {
+    if (!strncmp(argv[5], tmode_s[WT_TFR_MODE], TMODE_S_SIZE) && argc >= 7) {
         *tmode = WT_TFR_MODE;
+        process_opts(7, argc, argv, opts, inf_msg_buf);
         *loss_prob = atof(argv[6]);
+        
+        /* the server may ACK up to half the send window at once */
+        opts->ack_every = opts->window / 2 < 1 ? 1 : 
+            opts->window / 2 > ACK_EVERY_MAX ? ACK_EVERY_MAX : 
+            opts->window / 2;
 
         if (signbit(*loss_prob) || isgreater(*loss_prob, 1.0)) {
             errno = EINVAL;
@@ -223,3 +518,147 @@ static void process_argv(char* input_file, char* output_file, int port,
     }        
 }
 
+static void process_opts(int first, int argc, char** argv, tfr_opts_t* opts,
+    char* inf_msg_buf) {
+
+    for (int i = first; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            errno = EINVAL;
+            snprintf(inf_msg_buf, INF_MSG_SIZE, "Missing value for option %s",
+                argv[i]);
+            exit_cerr(__LINE__, inf_msg_buf);
+        }
+
+        if (!strcmp(argv[i], "-w")) {
+            opts->window = atoi(argv[i + 1]);
+
+            if (opts->window < 1 || opts->window > WINDOW_MAX) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Window size is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-s")) {
+            opts->payload_size = atoi(argv[i + 1]);
+
+            if (opts->payload_size < PAYLOAD_SIZE || 
+                    opts->payload_size > PAYLOAD_SIZE_MAX) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Payload size is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-c")) {
+            opts->cc = cc_find(argv[i + 1]);
+
+            if (!opts->cc) {
+                errno = EINVAL;
+                snprintf(inf_msg_buf, INF_MSG_SIZE, 
+                    "Unknown congestion control %s", argv[i + 1]);
+                exit_cerr(__LINE__, inf_msg_buf);
+            }
+        } else if (!strcmp(argv[i], "-b")) {
+            opts->pace_burst = atoi(argv[i + 1]);
+
+            if (opts->pace_burst < 1 || opts->pace_burst > WINDOW_MAX) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Pacing burst is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-g")) {
+            opts->pace_gain = atof(argv[i + 1]);
+
+            if (opts->pace_gain < 0) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Pacing gain must not be negative");
+            }
+        } else if (!strcmp(argv[i], "-m")) {
+            opts->batch = atoi(argv[i + 1]);
+
+            if (opts->batch < 1 || opts->batch > BATCH_MAX) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Batch size is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-o")) {
+            if (strcmp(argv[i + 1], "on") && strcmp(argv[i + 1], "off")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Offload must be on or off");
+            }
+
+            opts->gso = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-r")) {
+            if (strcmp(argv[i + 1], "read") && strcmp(argv[i + 1], "mmap")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "File access must be read or mmap");
+            }
+
+            opts->use_mmap = !strcmp(argv[i + 1], "mmap");
+        } else if (!strcmp(argv[i], "-z")) {
+            if (strcmp(argv[i + 1], "on") && strcmp(argv[i + 1], "off")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Zerocopy must be on or off");
+            }
+
+            opts->zerocopy = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-p")) {
+            opts->streams = atoi(argv[i + 1]);
+
+            if (opts->streams < 1 || opts->streams > STREAMS_MAX) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Number of streams is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-l")) {
+            long long range_size = atoll(argv[i + 1]);
+
+            if (range_size < 1) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Range size must be positive");
+            }
+
+            opts->range_size = range_size;
+        } else if (!strcmp(argv[i], "-i")) {
+            opts->csum = csum_find(argv[i + 1]);
+
+            if (opts->csum < 0) {
+                errno = EINVAL;
+                snprintf(inf_msg_buf, INF_MSG_SIZE, "Unknown checksum %s",
+                    argv[i + 1]);
+                exit_cerr(__LINE__, inf_msg_buf);
+            }
+        } else if (!strcmp(argv[i], "-f")) {
+            if (!strcmp(argv[i + 1], "off")) {
+                opts->fec = 0;
+            } else if (!strcmp(argv[i + 1], "auto")) {
+                opts->fec = FEC_AUTO;
+            } else {
+                opts->fec = atoi(argv[i + 1]);
+
+                if (opts->fec < FEC_K_MIN || opts->fec > FEC_K_MAX) {
+                    errno = EINVAL;
+                    exit_cerr(__LINE__, "Segments per parity segment is "
+                        "outside valid range");
+                }
+            }
+        } else if (!strcmp(argv[i], "-d")) {
+            if (strcmp(argv[i + 1], "on") && strcmp(argv[i + 1], "off")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Delta transfer must be on or off");
+            }
+
+            opts->delta = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-j")) {
+            if (strcmp(argv[i + 1], "on") && strcmp(argv[i + 1], "off")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Resumable transfer must be on or off");
+            }
+
+            opts->resume = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-x")) {
+            if (strcmp(argv[i + 1], "on") && strcmp(argv[i + 1], "off")) {
+                errno = EINVAL;
+                exit_cerr(__LINE__, "Compression must be on or off");
+            }
+
+            opts->compress = !strcmp(argv[i + 1], "on");
+        } else {
+            errno = EINVAL;
+            snprintf(inf_msg_buf, INF_MSG_SIZE, "Invalid option %s", argv[i]);
+            exit_cerr(__LINE__, inf_msg_buf);
+        }
+    }
+}
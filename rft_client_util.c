@@ -1,10 +1,23 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // sendmmsg
+#endif
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 #include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <pthread.h>
+#include <linux/errqueue.h>
 #include "rft_util.h"
 #include "rft_client_util.h"
+#include "rft_reader.h"
 
 /* 
  * UTILITY FUNCTIONS PROVIDED FOR YOU 
@@ -50,6 +63,54 @@ void exit_cerr(int line, char *msg) {
  * FUNCTIONS THAT YOU HAVE TO IMPLEMENT
  */
 
+/*
+ * set_rcv_timeout - set the time (usec) receiving on the socket waits for 
+ *      a datagram, 0 to wait without a time limit
+ */
+static bool set_rcv_timeout(int sockfd, long long usec) {
+    struct timeval tv;
+    tv.tv_sec = usec / 1000000;
+    tv.tv_usec = usec % 1000000;
+
+    return setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+/*
+ * set_pmtu_discover - set the path MTU discovery mode of the socket
+ *      (IP_PMTUDISC_DO or IP_PMTUDISC_PROBE, both set DF on datagrams)
+ */
+static bool set_pmtu_discover(int sockfd, int mode) {
+#ifdef IP_MTU_DISCOVER
+    return setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * allow_fragments - let the kernel fragment datagrams larger than the path
+ *      MTU (IP_PMTUDISC_DONT) once a segment fails with EMSGSIZE during the
+ *      transfer: the path MTU dropped below the size probed, and segments of
+ *      that size must still get through as they are resent. Returns false if
+ *      fragments were allowed already.
+ */
+static bool allow_fragments(int sockfd) {
+#ifdef IP_MTU_DISCOVER
+    int mode;
+    socklen_t len = sizeof(mode);
+
+    if (getsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, &len) || mode == IP_PMTUDISC_DONT ||
+        !set_pmtu_discover(sockfd, IP_PMTUDISC_DONT))
+        return false;
+
+    print_cmsg("Path MTU dropped below the segment size, segments are fragmented from now on");
+
+    return true;
+#else
+    return false;
+#endif
+}
+
 /*
  * See documentation in rft_client_util.h
  * Hints:
@@ -71,6 +132,14 @@ int create_udp_socket(struct sockaddr_in *server, char *server_addr, int port) {
     server->sin_addr.s_addr = inet_addr(server_addr);
     server->sin_port = htons(port);
     print_cmsg("Socket created");
+
+    /* 
+     * set DF on all datagrams: a segment too large for the path fails with
+     * EMSGSIZE instead of being fragmented
+     */
+    if (!set_pmtu_discover(sockfd, IP_PMTUDISC_DO))
+        print_cmsg("Path MTU discovery not supported, segments may fragment");
+
     return sockfd;
 
 }
@@ -84,149 +153,512 @@ int create_udp_socket(struct sockaddr_in *server, char *server_addr, int port) {
  *  - Look at server code.
  */
 bool send_metadata(int sockfd, struct sockaddr_in *server, off_t file_size,
-                   char *output_file) {
+                   char *output_file, tfr_opts_t *opts) {
+    size_t meta_size = sizeof(segment_t) + sizeof(metadata_t);
+    segment_t *meta_msg = calloc(1, meta_size);
+    segment_t *reply = calloc(1, meta_size);
+    metadata_t file_meta;
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
 
-    metadata_t *file_meta = (metadata_t *) malloc(sizeof(metadata_t));
-    file_meta->size = file_size;
-    memcpy(file_meta->name, output_file, FILE_NAME_SIZE);
-
-    size_t bytes_sent = sendto(sockfd, file_meta, sizeof(metadata_t), 0,
-                               (struct sockaddr *) server, sizeof(struct sockaddr_in));
-    if (bytes_sent < 0) {
-        close(sockfd);
-        free(file_meta);
-        return false;
-    } else if (!bytes_sent) {
+    if (!meta_msg || !reply) {
+        free(meta_msg);
+        free(reply);
         close(sockfd);
-        free(file_meta);
         return false;
-    } else {
-        free(file_meta);
-        print_cmsg("Start sending file");
-        print_sep();
-        print_sep();
-        return true;
     }
 
-}
+    memset(&file_meta, 0, sizeof(metadata_t));
+    file_meta.size = file_size;
+    file_meta.payload_size = opts->payload_size;
+    file_meta.range_offset = opts->range_offset;
+    file_meta.range_bytes = opts->range_bytes;
+    file_meta.manifest_bytes = opts->tree ? opts->tree->manifest_bytes : 0;
+    file_meta.csum = opts->csum;
+    file_meta.fec = opts->fec != 0;
+    file_meta.compress = opts->compress;
+    file_meta.delta_block = opts->script ? opts->script->block_size : 0;
+    file_meta.source = opts->source;
+    file_meta.ack_every = opts->ack_every;
+    strncpy(file_meta.name, output_file, FILE_NAME_SIZE - 1);
+
+    meta_msg->session = opts->session;
+    meta_msg->type = META_SEG;
+    meta_msg->payload_bytes = sizeof(metadata_t);
+    memcpy(meta_msg->payload, &file_meta, sizeof(metadata_t));
+
+    /* send the metadata until the server replies with the agreed settings */
+    for (int tries = 0; tries < META_RETRIES; tries++) {
+        ssize_t bytes_sent = sendto(sockfd, meta_msg, meta_size, 0,
+                                    (struct sockaddr *) server, sizeof(struct sockaddr_in));
+        if (bytes_sent <= 0 || !set_rcv_timeout(sockfd, META_TIMEOUT_USEC))
+            break;
+
+        ssize_t bytes = recvfrom(sockfd, reply, meta_size, 0,
+                                 (struct sockaddr *) server, &addr_len);
+
+        if (bytes == (ssize_t) meta_size && reply->type == META_SEG && reply->session == opts->session) {
+            memcpy(&file_meta, reply->payload, sizeof(metadata_t));
+            opts->payload_size = file_meta.payload_size;
+            opts->csum = file_meta.csum;
+
+            if (!file_meta.fec)
+                opts->fec = 0;
+
+            opts->compress = opts->compress && file_meta.compress;
+
+            if (!file_meta.source)
+                opts->source = 0;
 
+            opts->ack_every = file_meta.ack_every;
+
+            free(meta_msg);
+            free(reply);
+            return set_rcv_timeout(sockfd, 0);
+        }
+    }
+
+    free(meta_msg);
+    free(reply);
+    close(sockfd);
+    return false;
+}
 
 /*
- * See documentation in rft_client_util.h
- * Hints:
- *  - Remember to output appropriate information messages for the user to 
- *      follow progress of the transfer
- *  - Remember in this function you can exit with an error as long as you 
- *      close open resources you are given.
- *  - Look at server code.
+ * send_probe - send a path MTU probe with the given payload size and wait 
+ *      for the server to echo it, resending it up to PROBE_RETRIES times.
+ *      Returns true if the probe got through.
  */
-size_t send_file_normal(int sockfd, struct sockaddr_in *server, int infd,
-                        size_t bytes_to_read) {
+static bool send_probe(int sockfd, struct sockaddr_in *server, segment_t *probe,
+                       int size, int id) {
+    segment_t reply;
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+
+    probe->type = PROBE_SEG;
+    probe->sq = id;
+    probe->payload_bytes = size;
+
+    for (int tries = 0; tries < PROBE_RETRIES; tries++) {
+        /* EMSGSIZE: larger than the MTU of the local interface */
+        if (sendto(sockfd, probe, sizeof(segment_t) + size, 0,
+                   (struct sockaddr *) server, sizeof(struct sockaddr_in)) < 0)
+            return false;
 
-    char payload[PAYLOAD_SIZE];
+        long long deadline = now_usec() + PROBE_TIMEOUT_USEC;
+        long long wait;
+
+        /* skip late echoes of earlier probes */
+        while ((wait = deadline - now_usec()) > 0 && set_rcv_timeout(sockfd, wait)) {
+            ssize_t bytes = recvfrom(sockfd, &reply, sizeof(segment_t), 0,
+                                     (struct sockaddr *) server, &addr_len);
+            if (bytes < 0)
+                break;
+
+            if (bytes == (ssize_t) sizeof(segment_t) && reply.type == PROBE_SEG && reply.sq == id &&
+                reply.session == probe->session)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * confirm_digest - send the digest of the bytes of the transfer to the 
+ *      server once all segments are ACKed and wait for the server's digest,
+ *      resending it up to DIGEST_RETRIES times. Returns true if the digests
+ *      match, else false with errno EBADMSG (mismatch) or ETIMEDOUT (no 
+ *      reply).
+ */
+static bool confirm_digest(int sockfd, struct sockaddr_in *server, xxh64_state_t *st, tfr_opts_t *opts) {
     char inf_msg_buf[INF_MSG_SIZE];
-    char buff[bytes_to_read];
-    struct segment msg_payload;
-    int pay_count = 0;
-    int sq = 0;
-    int total_sent = 0;
-    segment_t ack_rec;
-    bool file_end = false;
+    size_t seg_size = sizeof(segment_t) + sizeof(digest_t);
+    segment_t *msg = calloc(1, seg_size);
+    segment_t *reply = malloc(ACK_SIZE + seg_size);     // room for late ACKs too
+    digest_t client = { .digest = xxh64_digest(st), .bytes = st->total };
+    digest_t server_digest;
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+
+    if (!msg || !reply) {
+        free(msg);
+        free(reply);
+        errno = ENOMEM;
+        return false;
+    }
+
+    msg->session = opts->session;
+    msg->type = DIGEST_SEG;
+    msg->payload_bytes = sizeof(digest_t);
+    memcpy(msg->payload, &client, sizeof(digest_t));
+    errno = ETIMEDOUT;
 
-    //Clear Payload before first iteration in case limit not reached
-    memset(payload, 0x00, PAYLOAD_SIZE);
+    for (int tries = 0; tries < DIGEST_RETRIES && errno == ETIMEDOUT; tries++) {
+        if (sendto(sockfd, msg, seg_size, 0, (struct sockaddr *) server, sizeof(struct sockaddr_in)) < 0)
+            break;
 
-    if (read(infd, buff, bytes_to_read) > 0) {
+        long long deadline = now_usec() + DIGEST_TIMEOUT_USEC;
+        long long wait;
 
-        for (int i = 0; i <= bytes_to_read; ++i) {
+        /* skip ACKs of resent segments still on their way */
+        while ((wait = deadline - now_usec()) > 0 && set_rcv_timeout(sockfd, wait)) {
+            ssize_t bytes = recvfrom(sockfd, reply, ACK_SIZE + seg_size, 0, (struct sockaddr *) server, &addr_len);
+
+            if (bytes < 0) {
+                errno = ETIMEDOUT;
+                break;
+            }
 
-            if (i == bytes_to_read) {
-                file_end = true;
+            if (bytes == (ssize_t) seg_size && reply->type == DIGEST_SEG && reply->session == opts->session) {
+                memcpy(&server_digest, reply->payload, sizeof(digest_t));
+                errno = server_digest.digest == client.digest && server_digest.bytes == client.bytes ? 0 : EBADMSG;
+                break;
             }
+        }
+    }
+
+    if (!errno) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Digest %016llx of %ld bytes confirmed by the server",
+                 (unsigned long long) client.digest, (long) client.bytes);
+        print_cmsg(inf_msg_buf);
+    } else if (errno == EBADMSG) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Digest %016llx of %ld bytes, server's digest %016llx of %ld bytes",
+                 (unsigned long long) client.digest, (long) client.bytes,
+                 (unsigned long long) server_digest.digest, (long) server_digest.bytes);
+        print_cmsg(inf_msg_buf);
+    }
 
-            if (file_end || PAYLOAD_SIZE - 1 == pay_count) {
+    free(msg);
+    free(reply);
 
-                memset(msg_payload.payload, 0x00, PAYLOAD_SIZE);
-                memcpy(msg_payload.payload, &payload, pay_count + 1);
+    return !errno;
+}
 
-                int cs = checksum(msg_payload.payload, false);
-                msg_payload.checksum = cs;
-                msg_payload.last = file_end;
-                msg_payload.payload_bytes = pay_count;
-                msg_payload.sq = sq;
+/*
+ * See documentation in rft_client_util.h
+ */
+void probe_payload_size(int sockfd, struct sockaddr_in *server, tfr_opts_t *opts) {
+    int lo = PAYLOAD_SIZE;              // largest payload size known to get through
+    int hi = opts->payload_size;        // largest payload size that may get through
+    int probe = hi;                     // start with the size agreed with the server
+    int id = 0;
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t *seg = calloc(1, sizeof(segment_t) + hi);
 
-                total_sent += pay_count;
-                pay_count = 0;
-                bool sending = true;
+    if (!seg) {
+        close(sockfd);
+        exit_cerr(__LINE__, "Failed to allocate probe segment");
+    }
 
-                size_t seg_size = sizeof(segment_t);
-                socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+    seg->session = opts->session;
 
-                while (sending) {
-                    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending segment with sq: %d, payload bytes: %zu, "
-                                                        "checksum: %d", msg_payload.sq, msg_payload.payload_bytes,
-                             msg_payload.checksum);
-                    print_cmsg(inf_msg_buf);
+    /* probes ignore the path MTU cached by the kernel to detect increases */
+    set_pmtu_discover(sockfd, IP_PMTUDISC_PROBE);
 
-                    ssize_t payload_bytes = sendto(sockfd, &msg_payload, sizeof(struct segment), 0,
-                                                   (struct sockaddr *) server, addr_len);
+    /* binary search: up on an echo, down on EMSGSIZE or timeout */
+    while (lo < hi) {
+        bool through = send_probe(sockfd, server, seg, probe, id++);
 
-                    if (payload_bytes < 0) {
-                        close(infd);
-                        close(sockfd);
-                        exit_cerr(__LINE__, "Sending Payload error");
-                    } else if (!payload_bytes) {
-                        print_cmsg("Ending Connection");
-                        sending = false;
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Path MTU probe with payload size: %d %s",
+                 probe, through ? "got through" : "lost");
+        print_cmsg(inf_msg_buf);
 
-                    } else {
-                        snprintf(inf_msg_buf, INF_MSG_SIZE, "Sent payload: \n%s", msg_payload.payload);
-                        print_cmsg(inf_msg_buf);
-                    }
-                    print_sep();
-                    print_sep();
-
-                    memset(&ack_rec, 0, seg_size);
-                    print_cmsg("Waiting for an ack");
-
-                    ssize_t ack_bytes = recvfrom(sockfd, &ack_rec, seg_size, 0,
-                                                 (struct sockaddr *) server, &addr_len);
-                    if (ack_bytes < 0) {
-                        close(infd);
-                        close(sockfd);
-                        exit_cerr(__LINE__, "ACK Receive Failure");
-                    } else if (!ack_bytes) {
-                        errno = ENOMSG;
-                        close(infd);
-                        close(sockfd);
-                        exit_cerr(__LINE__, "Ending connection - no ACK received");
-                    } else {
-                        snprintf(inf_msg_buf, INF_MSG_SIZE, "ACK with sq: %d Received", ack_rec.sq);
-                        print_cmsg(inf_msg_buf);
+        if (through)
+            lo = probe;
+        else
+            hi = probe - 1;
 
-                        sending = false;
-                        memset(payload, 0x00, PAYLOAD_SIZE);
-                        sq++;
-                        print_sep();
-                        print_sep();
-                    }
+        probe = lo + (hi - lo + 1) / 2;
+    }
+
+    set_pmtu_discover(sockfd, IP_PMTUDISC_DO);
+    set_rcv_timeout(sockfd, 0);
+    free(seg);
+
+    opts->payload_size = lo;
+}
+
+#define DELTA_WINDOW 32         // requests for signatures in flight
+
+/*
+ * fetch_sigs - ask the server for the signatures of all full blocks of its copy of the file, a window of requests
+ *      at a time, asking again for those not answered. Returns the count signatures of blocks of block_size bytes
+ *      or NULL if the server has no copy with a full block or does not reply
+ */
+static delta_sig_t *fetch_sigs(int sockfd, struct sockaddr_in *server, char *output_file, tfr_opts_t *opts,
+                               int *count, int *block_size) {
+    int reply_max = opts->payload_size < PAYLOAD_SIZE_DEFAULT ? opts->payload_size : PAYLOAD_SIZE_DEFAULT;
+    int per = (int) ((reply_max - sizeof(delta_sigs_t)) / sizeof(delta_sig_t));  // signatures per reply
+    size_t reply_size = sizeof(segment_t) + sizeof(delta_sigs_t) + (per > 1 ? per : 1) * sizeof(delta_sig_t);
+    segment_t *req = calloc(1, sizeof(segment_t) + sizeof(delta_req_t));
+    segment_t *reply = malloc(reply_size);
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+    delta_req_t ask;
+    delta_sig_t *sigs = NULL;
+    bool *have = NULL;          // reply c (signatures from block c * per on) received
+    int chunks = -1;            // replies to get, -1 until the size of the copy is known
+    int got = 0;                // replies received
+    int lo = 0;                 // first reply not received
+    int tries = 0;              // rounds of requests without a reply
+    bool none = false;          // the server has no copy
+    off_t basis = 0;
+
+    per = per > 1 ? per : 1;
+    memset(&ask, 0, sizeof(delta_req_t));
+    strncpy(ask.name, output_file, FILE_NAME_SIZE - 1);
+    ask.max = per;
+
+    while (req && reply && !none && tries < DELTA_RETRIES && (chunks < 0 || got < chunks)) {
+        /* one request until the first reply tells the size of the copy, then a window of them */
+        int window = chunks < 0 ? 1 : DELTA_WINDOW;
+        int asked = 0;
+        int answered = 0;
+
+        while (chunks > 0 && have[lo])
+            lo++;
+
+        for (int c = lo; asked < window && c < (chunks < 0 ? 1 : chunks); c++) {
+            if (chunks > 0 && have[c])
+                continue;
+
+            ask.first = c * per;
+            req->session = opts->session;
+            req->sq = c;
+            req->type = DELTA_SEG;
+            req->payload_bytes = sizeof(delta_req_t);
+            memcpy(req->payload, &ask, sizeof(delta_req_t));
+
+            if (sendto(sockfd, req, sizeof(segment_t) + sizeof(delta_req_t), 0, (struct sockaddr *) server,
+                       sizeof(struct sockaddr_in)) > 0)
+                asked++;
+        }
+
+        long long deadline = now_usec() + DELTA_TIMEOUT_USEC;
+        long long wait;
+
+        while (answered < asked && (wait = deadline - now_usec()) > 0 && set_rcv_timeout(sockfd, wait)) {
+            ssize_t bytes = recvfrom(sockfd, reply, reply_size, 0, (struct sockaddr *) server, &addr_len);
+            delta_sigs_t hdr;
+
+            if (bytes < 0)
+                break;
+
+            if (bytes < (ssize_t) (sizeof(segment_t) + sizeof(delta_sigs_t)) || reply->type != DELTA_SEG ||
+                reply->session != opts->session)
+                continue;
+
+            memcpy(&hdr, reply->payload, sizeof(delta_sigs_t));
+
+            if (hdr.basis_bytes < 0) {
+                none = true;
+                break;
+            }
+
+            if (chunks < 0) {
+                if (hdr.block_size < DELTA_BLOCK_MIN || hdr.block_size > DELTA_BLOCK_MAX ||
+                    hdr.basis_bytes / hdr.block_size > INT_MAX) {
+                    none = true;
+                    break;
                 }
 
+                basis = hdr.basis_bytes;
+                *block_size = hdr.block_size;
+                *count = (int) (basis / hdr.block_size);
+                chunks = (*count + per - 1) / per;
+                sigs = malloc((*count ? *count : 1) * sizeof(delta_sig_t));
+                have = calloc(chunks ? chunks : 1, sizeof(bool));
+
+                if (!sigs || !have || !chunks) {
+                    none = true;
+                    break;
+                }
             }
-            payload[pay_count] = buff[i];
-            pay_count++;
+
+            /* replies about another copy (the file changed) or asked for again are dropped */
+            int c = hdr.first / per;
+            int n = *count - hdr.first < per ? *count - hdr.first : per;
+
+            if (hdr.basis_bytes != basis || hdr.block_size != *block_size || hdr.first < 0 ||
+                hdr.first % per || c >= chunks || have[c] || hdr.count != n ||
+                bytes != (ssize_t) (sizeof(segment_t) + sizeof(delta_sigs_t) + n * sizeof(delta_sig_t)))
+                continue;
+
+            memcpy(sigs + hdr.first, reply->payload + sizeof(delta_sigs_t), n * sizeof(delta_sig_t));
+            have[c] = true;
+            got++;
+            answered++;
         }
-    } else {
-        errno = ENODATA;
-        close(infd);
+
+        tries = answered ? 0 : tries + 1;
+    }
+
+    free(req);
+    free(reply);
+    free(have);
+
+    if (chunks <= 0 || got < chunks) {
+        free(sigs);
+        return NULL;
+    }
+
+    return sigs;
+}
+
+/*
+ * See documentation in rft_client_util.h
+ */
+bool make_delta(struct sockaddr_in *server, int infd, off_t file_size, char *output_file, tfr_opts_t *opts,
+                delta_t *delta) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    long long start = now_usec();
+    int count = 0;
+    int block_size = 0;
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    delta_sig_t *sigs = sockfd < 0 ? NULL : fetch_sigs(sockfd, server, output_file, opts, &count, &block_size);
+
+    if (sockfd >= 0)
         close(sockfd);
-        exit_cerr(__LINE__, "Failed to read file");
+
+    if (!sigs) {
+        print_cmsg("Server has no copy of the file with a full block, sending the file");
+        return false;
     }
-    close(infd);
-    close(sockfd);
-    return total_sent;
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Signatures of %d blocks of %d bytes of the server's copy received in "
+                                        "%.1f ms", count, block_size, (now_usec() - start) / 1000.0);
+    print_cmsg(inf_msg_buf);
+
+    /* the file is scanned from its mapping */
+    start = now_usec();
+    unsigned char *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, infd, 0);
+    bool built = map != MAP_FAILED && delta_encode(delta, map, file_size, sigs, count, block_size);
+
+    if (map != MAP_FAILED)
+        munmap(map, file_size);
+
+    free(sigs);
+
+    if (!built) {
+        print_cerr(__LINE__, "Could not build the delta, sending the file");
+        return false;
+    }
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Delta: %ld bytes of the file in blocks of the server's copy, %ld bytes "
+                                        "literal, script of %ld bytes in %ld ops built in %.1f ms",
+             (long) delta->matched, (long) delta->literal, (long) delta->bytes, delta->ops,
+             (now_usec() - start) / 1000.0);
+    print_cmsg(inf_msg_buf);
+
+    return true;
+}
+
+/* segments per sample of how well the payloads of a transfer compress */
+#define LZ_SAMPLE 32
+
+/* 
+ * with compression switched off, one segment in LZ_PROBE_EVERY is still
+ * compressed to find out if the data has become compressible
+ */
+#define LZ_PROBE_EVERY 64
+
+/* compression stays on while it saves at least 1/LZ_MIN_SAVING of the bytes */
+#define LZ_MIN_SAVING 8
+
+/*
+ * compression of the payloads of data segments: the state of the sampling
+ * that switches it off for data that does not compress, and the counts 
+ * for the report
+ */
+typedef struct compressor {
+    bool on;                // compressing (the last sample saved enough)
+    int sampled;            // segments compressed in the current sample
+    size_t sample_raw;      // their bytes
+    size_t sample_sent;     // bytes sent for them
+    long skipped;           // segments not compressed since switched off
+    long packed;            // segments sent compressed
+    long bypassed;          // segments compressed that did not shrink
+    long switched_off;      // times compression was switched off
+    uint64_t raw;           // payload bytes of all segments
+    uint64_t sent;          // payload bytes sent for them
+    uint64_t tried;         // payload bytes compressed
+    long long usec;         // time spent compressing
+    char *buf;              // room for a compressed payload
+} compressor_t;
+
+/*
+ * compress_seg - compress the payload of a data segment (its raw bytes at 
+ *      data) into z->buf, unless compression is switched off. A payload 
+ *      that does not shrink is sent as it is. After every LZ_SAMPLE 
+ *      segments compressed, compression is switched off if they saved less
+ *      than 1/LZ_MIN_SAVING of their bytes; while it is off, one segment in
+ *      LZ_PROBE_EVERY is compressed and switches it back on if it saves
+ *      that much. Returns true if seg->payload_bytes bytes at z->buf are to
+ *      be sent, with seg->compressed set
+ */
+static bool compress_seg(compressor_t *z, segment_t *seg, const char *data) {
+    size_t len = seg->payload_bytes;
+
+    z->raw += len;
+
+    if (!z->on && ++z->skipped % LZ_PROBE_EVERY) {
+        z->sent += len;
+        return false;
+    }
+
+    long long start = now_usec();
+    size_t packed = lz_compress(data, len, z->buf, len - 1);
+    size_t sent = packed ? packed : len;
+
+    z->usec += now_usec() - start;
+    z->tried += len;
+    z->sent += sent;
+
+    if (!z->on) {
+        /* a probe of data not compressed for a while */
+        z->on = len - sent >= len / LZ_MIN_SAVING;
+        z->sampled = 0;
+        z->sample_raw = 0;
+        z->sample_sent = 0;
+    } else {
+        z->sample_raw += len;
+        z->sample_sent += sent;
+
+        if (++z->sampled == LZ_SAMPLE) {
+            if (z->sample_raw - z->sample_sent < z->sample_raw / LZ_MIN_SAVING) {
+                z->on = false;
+                z->skipped = 0;
+                z->switched_off++;
+            }
+
+            z->sampled = 0;
+            z->sample_raw = 0;
+            z->sample_sent = 0;
+        }
+    }
+
+    if (!packed) {
+        z->bypassed++;
+        return false;
+    }
+
+    seg->payload_bytes = packed;
+    seg->compressed = true;
+    z->packed++;
+
+    return true;
 }
 
+/* print_compress - print the compression ratio and time of a transfer */
+static void print_compress(compressor_t *z) {
+    char inf_msg_buf[INF_MSG_SIZE];
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Compression: %llu payload bytes sent as %llu (ratio %.2f), %ld segments "
+                                        "compressed, %ld did not shrink, switched off %ld times",
+             (unsigned long long) z->raw, (unsigned long long) z->sent,
+             z->sent ? (double) z->raw / z->sent : 1.0, z->packed, z->bypassed, z->switched_off);
+    print_cmsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Compression time: %lld usec for %llu bytes (%.0f MB/s)",
+             z->usec, (unsigned long long) z->tried, z->usec ? (double) z->tried / z->usec : 0.0);
+    print_cmsg(inf_msg_buf);
+}
 
 /*
  * See documentation in rft_client_util.h
@@ -237,128 +669,1386 @@ size_t send_file_normal(int sockfd, struct sockaddr_in *server, int infd,
  *      close open resources you are given.
  *  - Look at server code.
  */
-size_t send_file_with_timeout(int sockfd, struct sockaddr_in *server, int infd,
-                              size_t bytes_to_read, float loss_prob) {
-    char payload[PAYLOAD_SIZE];
+size_t send_file_normal(int sockfd, struct sockaddr_in *server, int infd,
+                        size_t bytes_to_read, tfr_opts_t *opts) {
+
+    int payload_size = opts->payload_size;
+    size_t chunk = payload_size;        // file bytes per segment
     char inf_msg_buf[INF_MSG_SIZE];
-    char buff[bytes_to_read];
-    struct segment msg_payload;
-    int total_sent = 0;
-    int pay_count = 0;
+    segment_t *msg_payload = malloc(sizeof(segment_t) + payload_size);
     int sq = 0;
-    segment_t ack_rec;
-    bool file_end = false;
+    size_t total_sent = 0;
+    segment_t *ack_rec = malloc(ACK_SIZE);
+    compressor_t z = { .on = true, .buf = opts->compress ? malloc(payload_size) : NULL };
+    file_reader_t reader;
+    xxh64_state_t digest;
 
-    // Define and set timeout
-    struct timeval tv;
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
-
-    //Clear Payload before first iteration in case limit not reached
-    memset(payload, 0x00, PAYLOAD_SIZE);
+    if (!msg_payload || !ack_rec || (opts->compress && !z.buf)) {
+        close(infd);
+        close(sockfd);
+        exit_cerr(__LINE__, "Failed to allocate segment");
+    }
 
-    if (read(infd, buff, bytes_to_read) > 0) {
+    if (opts->tree)
+        reader_open_tree(&reader, infd, opts->tree);
+    else
+        reader_open(&reader, infd, opts->range_offset + bytes_to_read, opts->use_mmap);
 
-        for (int i = 0; i <= bytes_to_read; ++i) {
+    xxh64_init(&digest, 0);
 
-            if (i == bytes_to_read) {
-                file_end = true;
-            }
+    /* read each chunk of the file just before sending it */
+    for (size_t offset = 0; offset < bytes_to_read; offset += chunk) {
+        size_t pay_count = bytes_to_read - offset < chunk ? bytes_to_read - offset : chunk;
 
+        memset(msg_payload, 0x00, sizeof(segment_t) + payload_size);
 
-            if (file_end || PAYLOAD_SIZE - 1 == pay_count) {
+        if (reader_read(&reader, opts->range_offset + offset, msg_payload->payload, pay_count) !=
+            (ssize_t) pay_count) {
+            errno = ENODATA;
+            close(infd);
+            close(sockfd);
+            exit_cerr(__LINE__, "Failed to read file");
+        }
 
-                memset(msg_payload.payload, 0x00, PAYLOAD_SIZE);
-                memcpy(msg_payload.payload, &payload, pay_count + 1);
+        /* the digest takes each chunk as it is read, in offset order */
+        xxh64_update(&digest, msg_payload->payload, pay_count);
+        msg_payload->session = opts->session;
+        msg_payload->type = DATA_SEG;
+        msg_payload->last = offset + pay_count == bytes_to_read;
+        msg_payload->payload_bytes = pay_count;
+        msg_payload->offset = opts->range_offset + offset;
+        msg_payload->sq = sq;
 
-                msg_payload.last = file_end;
-                msg_payload.payload_bytes = pay_count;
-                msg_payload.sq = sq;
+        if (opts->compress && compress_seg(&z, msg_payload, msg_payload->payload))
+            memcpy(msg_payload->payload, z.buf, msg_payload->payload_bytes);
 
-                total_sent += pay_count;
-                pay_count = 0;
+        msg_payload->checksum = seg_checksum(opts->csum, msg_payload, msg_payload->payload, false);
 
-                bool sending = true;
+        total_sent += pay_count;
+        bool sending = true;
 
-                size_t seg_size = sizeof(segment_t);
-                socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+        size_t seg_size = sizeof(segment_t) + msg_payload->payload_bytes;
+        socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
 
-                while (sending) {
-                    bool corrupt = is_corrupted(loss_prob);
-                    int cs = checksum(msg_payload.payload, corrupt);
-                    msg_payload.checksum = cs;
+        while (sending) {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending segment with sq: %d, payload bytes: %zu, "
+                                                "checksum: %d", msg_payload->sq, msg_payload->payload_bytes,
+                     msg_payload->checksum);
+            print_cmsg(inf_msg_buf);
 
-                    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending segment with sq: %d, payload bytes: %zu, "
-                                                        "checksum: %d", msg_payload.sq, msg_payload.payload_bytes,
-                             msg_payload.checksum);
-                    print_cmsg(inf_msg_buf);
+            ssize_t payload_bytes = sendto(sockfd, msg_payload, seg_size, 0,
+                                           (struct sockaddr *) server, addr_len);
 
-                    ssize_t payload_bytes = sendto(sockfd, &msg_payload, seg_size, 0,
-                                                   (struct sockaddr *) server, addr_len);
+            if (payload_bytes < 0 && errno == EMSGSIZE && allow_fragments(sockfd))
+                continue;
 
-                    if (payload_bytes < 0) {
-                        close(infd);
-                        close(sockfd);
-                        exit_cerr(__LINE__, "Sending Payload error");
-                    } else if (!payload_bytes) {
-                        sending = false;
-                        print_cmsg("Ending Connection");
+            if (payload_bytes < 0) {
+                close(infd);
+                close(sockfd);
+                exit_cerr(__LINE__, "Sending Payload error");
+            } else if (!payload_bytes) {
+                print_cmsg("Ending Connection");
+                sending = false;
 
-                    } else {
-                        snprintf(inf_msg_buf, INF_MSG_SIZE, "Sent payload: \n%s", msg_payload.payload);
-                        print_cmsg(inf_msg_buf);
-                    }
-                    print_sep();
-                    print_sep();
+            } else {
+                snprintf(inf_msg_buf, INF_MSG_SIZE, "Sent %zd bytes", payload_bytes);
+                print_cmsg(inf_msg_buf);
+            }
+            print_sep();
+            print_sep();
 
-                    memset(&ack_rec, 0, seg_size);
+            memset(ack_rec, 0, ACK_SIZE);
+            print_cmsg("Waiting for an ack");
 
-                    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-                        close(sockfd);
-                        close(infd);
-                        exit_cerr(__LINE__, "Error Setting timeout");
-                    }
-                    print_cmsg("Waiting for an ack");
-                    ssize_t ack_bytes = recvfrom(sockfd, &ack_rec, seg_size, 0,
-                                                 (struct sockaddr *) server, &addr_len);
-
-                    if (ack_bytes < 0) {
-                        print_cmsg("TIMEOUT reached resending ACK with new cs");
-
-                    } else if (!ack_bytes) {
-                        errno = ENOMSG;
-                        close(sockfd);
-                        close(infd);
-                        exit_cerr(__LINE__, "Ending connection - no ACK received");
-                    } else {
-                        snprintf(inf_msg_buf, INF_MSG_SIZE, "ACK with sq: %d Received", ack_rec.sq);
-                        print_cmsg(inf_msg_buf);
+            ssize_t ack_bytes = recvfrom(sockfd, ack_rec, ACK_SIZE, 0,
+                                         (struct sockaddr *) server, &addr_len);
+            if (ack_bytes < 0) {
+                close(infd);
+                close(sockfd);
+                exit_cerr(__LINE__, "ACK Receive Failure");
+            } else if (!ack_bytes) {
+                errno = ENOMSG;
+                close(infd);
+                close(sockfd);
+                exit_cerr(__LINE__, "Ending connection - no ACK received");
+            } else {
+                snprintf(inf_msg_buf, INF_MSG_SIZE, "ACK with sq: %d Received", ack_rec->sq);
+                print_cmsg(inf_msg_buf);
 
-                        if (ack_rec.sq == sq) {
-                            print_cmsg("SQ matches");
-                            memset(payload, 0x00, PAYLOAD_SIZE);
-                            sending = false;
-                            sq++;
-                            print_sep();
-                            print_sep();
-                        }
-                    }
-                }
+                sending = false;
+                sq++;
+                print_sep();
+                print_sep();
             }
-            payload[pay_count] = buff[i];
-            pay_count++;
         }
-    } else {
-        errno = ENODATA;
+    }
+    reader_close(&reader);
+    free(msg_payload);
+    free(ack_rec);
+
+    if (opts->compress)
+        print_compress(&z);
+
+    free(z.buf);
+
+    if (!confirm_digest(sockfd, server, opts->script ? &opts->script->digest : &digest, opts)) {
         close(infd);
         close(sockfd);
-        exit_cerr(__LINE__, "Failed to read file");
+        exit_cerr(__LINE__, "Server did not confirm the digest of the transfer");
     }
-    snprintf(inf_msg_buf, INF_MSG_SIZE, "Total segments sent: %d", sq);
-    print_cmsg(inf_msg_buf);
-    close(sockfd);
+
     close(infd);
+    close(sockfd);
     return total_sent;
 }
 
 
+/* 
+ * limits of the time to wait for the ACK of a data segment before resending 
+ * it (retransmission timeout, RTO), the RTO before the first RTT sample
+ */
+#define RTO_INIT_USEC 1000000
+#define RTO_MIN_USEC 2000
+#define RTO_MAX_USEC 60000000
+
+/* retransmission timeout estimator (RFC 6298) */
+typedef struct rtt_est {
+    long long srtt;         // smoothed round trip time (usec), 0 until sampled
+    long long rttvar;       // round trip time variation (usec)
+    long long rto;          // retransmission timeout (usec)
+} rtt_est_t;
+
+/* 
+ * rtt_sample - update the RTT estimate and RTO with a round trip time 
+ *      measured for a segment that was not resent (Karn's rule)
+ */
+static void rtt_sample(rtt_est_t *rtt, long long r) {
+    if (!rtt->srtt) {
+        rtt->srtt = r;
+        rtt->rttvar = r / 2;
+    } else {
+        long long err = rtt->srtt > r ? rtt->srtt - r : r - rtt->srtt;
+        rtt->rttvar = (3 * rtt->rttvar + err) / 4;
+        rtt->srtt = (7 * rtt->srtt + r) / 8;
+    }
+
+    rtt->rto = rtt->srtt + 4 * rtt->rttvar;
+
+    if (rtt->rto < RTO_MIN_USEC)
+        rtt->rto = RTO_MIN_USEC;
+    else if (rtt->rto > RTO_MAX_USEC)
+        rtt->rto = RTO_MAX_USEC;
+}
+
+/* 
+ * rtt_backoff - double the RTO after a timeout, it stays backed off until
+ *      the next RTT sample
+ */
+static void rtt_backoff(rtt_est_t *rtt) {
+    rtt->rto = rtt->rto * 2 > RTO_MAX_USEC ? RTO_MAX_USEC : rtt->rto * 2;
+}
+
+/* 
+ * number of segments sent after a segment that must be (selectively) ACKed
+ * before the segment is considered lost and resent without waiting for its
+ * timer
+ */
+#define DUP_THRESH 3
+
+/* a data segment in the send window of send_file_with_timeout */
+typedef struct win_slot {
+    segment_t *seg;         // copy of the segment kept for retransmission
+    char *data;             // its payload: in seg, or in the mapping of the
+                            // file when sent without copying
+    long zc_id;             // id of its last MSG_ZEROCOPY send, -1 if none
+    bool acked;             // set when the ACK for the segment is received
+    bool resent;            // segment was resent, its ACK gives no RTT sample
+    long long sent;         // time (usec) of the last transmission
+    long tx;                // order of the last transmission of the segment
+    long fec_tx;            // order of the first transmission after the 
+                            // parity of its block, LONG_MAX until the 
+                            // parity is sent, -1 without FEC
+    long delivered;         // segments ACKed at the last transmission
+    long long delivered_time;   // time of the last ACK before the transmission
+} win_slot_t;
+
+/* counters of the sender to order transmissions and sample delivery rate */
+typedef struct send_count {
+    long tx;                // segments transmitted so far
+    long delivered;         // segments ACKed so far
+    long long delivered_time;   // time (usec) delivered last increased
+} send_count_t;
+
+/*
+ * token bucket pacing the transmissions of data segments: tokens (bytes)
+ * accrue at the pacing rate up to the burst size, a segment is sent when
+ * there are tokens for all its bytes. Resent segments are not held back
+ * but take their tokens too, which may leave the bucket in debt
+ */
+typedef struct pacer {
+    double rate;            // bytes/sec to send at, 0 to send unpaced
+    double tokens;          // bytes that may be sent now
+    double burst;           // max tokens, bytes sent back to back
+    long long stamp;        // time (usec) tokens were last added
+    int delays;             // times a segment was held back
+} pacer_t;
+
+/* pacer_update - add the tokens accrued since the last update at a new rate */
+static void pacer_update(pacer_t *p, double rate, long long now) {
+    if (p->rate > 0)
+        p->tokens += p->rate * (now - p->stamp) / 1e6;
+    else
+        p->tokens = p->burst;   // unpaced until now, start with a full bucket
+
+    if (p->tokens > p->burst)
+        p->tokens = p->burst;
+
+    p->rate = rate;
+    p->stamp = now;
+}
+
+/*
+ * pacer_delay - time (usec) until there are tokens to send the given bytes,
+ *      0 if they may be sent now
+ */
+static long long pacer_delay(pacer_t *p, size_t bytes) {
+    if (p->rate <= 0 || p->tokens >= (double) bytes)
+        return 0;
+
+    return (long long) ((bytes - p->tokens) * 1e6 / p->rate) + 1;
+}
+
+/*
+ * wait_readable - wait up to usec (0 to only check) for a datagram on the
+ *      socket. Unlike SO_RCVTIMEO, which sleeps in whole clock ticks, pselect
+ *      uses a high resolution timer, precise enough to pace segments
+ */
+static bool wait_readable(int sockfd, long long usec) {
+    fd_set fds;
+    struct timespec ts = { .tv_sec = usec / 1000000, .tv_nsec = usec % 1000000 * 1000 };
+
+    FD_ZERO(&fds);
+    FD_SET(sockfd, &fds);
+
+    return pselect(sockfd + 1, &fds, NULL, NULL, &ts, NULL) > 0;
+}
+
+/* limits of the segments the kernel sends from one buffer (UDP GSO) */
+#define GSO_SEGS_MAX 64
+#define GSO_BYTES_MAX DGRAM_SIZE_MAX
+
+/* 
+ * max segments in a GSO message sent with MSG_ZEROCOPY: the kernel pins the
+ * pages of each iovec as a fragment of one packet buffer, of which there are
+ * at most 17 (MAX_SKB_FRAGS), and a segment takes up to four
+ */
+#define ZC_GSO_SEGS_MAX 4
+
+/* 
+ * max time to wait for the kernel to release the buffers of a MSG_ZEROCOPY
+ * send before a segment header in them is rewritten
+ */
+#define ZC_WAIT_USEC 10000
+
+/* 
+ * segments queued to be sent to the server with one sendmmsg call, each
+ * message addresses the server. With UDP GSO a message carries a run of 
+ * segments that the kernel splits into datagrams of the size of the first
+ * segment (the last may be shorter). A segment is one iovec if its payload
+ * follows its header in the slot, or two (header and payload in the mapping
+ * of the file) if it is sent from the mapping
+ */
+typedef struct send_batch {
+    struct mmsghdr *msgs;
+    struct iovec *iov;      // iovecs of the queued segments, in order
+    win_slot_t **slots;     // slot of each queued segment
+    int *seg_iov;           // index of the first iovec of each queued segment
+    size_t *seg_len;        // bytes of each queued segment
+    char *ctrl;             // UDP_SEGMENT control message of each message
+    int len;                // segments queued
+    int iov_len;            // iovecs used
+    int max;                // segments sent per call
+    bool gso;               // send runs of segments as one GSO message
+    bool zerocopy;          // send with MSG_ZEROCOPY
+    int csum;               // checksum algorithm of the segments
+    long calls;             // sendmmsg calls made
+    long sent;              // segments sent
+    long gso_msgs;          // GSO messages sent
+    long gso_sent;          // segments sent in GSO messages
+    long zc_sends;          // MSG_ZEROCOPY messages sent (id of the next)
+    long zc_done;           // MSG_ZEROCOPY messages the kernel completed
+    long zc_copied;         // completed messages the kernel copied after all
+} send_batch_t;
+
+#define GSO_CTRL_SIZE CMSG_SPACE(sizeof(uint16_t))
+#define SEG_IOV_MAX 2       // iovecs of a segment
+
+/* weight of the loss rate of the last block in the smoothed loss rate */
+#define FEC_LOSS_GAIN 0.125
+
+/*
+ * the parity segment of the block of data segments being sent (FEC): the 
+ * XOR of the payloads of the segments of the block sent so far, sent once
+ * the block is complete
+ */
+typedef struct fec_sender {
+    int k;                  // segments per block, 0 without FEC
+    bool adapt;             // k follows the loss rate (FEC_AUTO)
+    int first;              // sq of the first segment of the block
+    int count;              // segments XORed into the parity
+    size_t size;            // room for payload of the parity segment
+    win_slot_t slot;        // the parity segment
+    double loss;            // smoothed loss rate
+    long lost;              // segments lost when the block started
+    long tx;                // transmissions when the block started
+    long recovered;         // segments the server recovered from parity
+    long sent;              // parity segments sent
+    int k_min;              // fewest and most segments in a block sent
+    int k_max;
+} fec_sender_t;
+
+/*
+ * gso_supported - check that the kernel segments UDP datagrams for the 
+ *      socket (UDP_SEGMENT)
+ */
+static bool gso_supported(int sockfd) {
+#ifdef UDP_SEGMENT
+    int gso_size = 0;
+    socklen_t len = sizeof(gso_size);
+
+    return getsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &gso_size, &len) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * enable_zerocopy - let sends on the socket pin the user pages rather than
+ *      copy them (SO_ZEROCOPY)
+ */
+static bool enable_zerocopy(int sockfd) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int on = 1;
+
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * zc_reap - read the completion notifications of MSG_ZEROCOPY sends from the
+ *      error queue of the socket. Each covers a range of send ids, which the
+ *      kernel completes in order
+ */
+static void zc_reap(int sockfd, send_batch_t *batch) {
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    char ctrl[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+
+    while (batch->zerocopy) {
+        struct msghdr msg = { .msg_control = ctrl, .msg_controllen = sizeof(ctrl) };
+
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *ee = (struct sock_extended_err *) CMSG_DATA(cm);
+
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR ||
+                ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                batch->zc_copied += ee->ee_data - ee->ee_info + 1;
+
+            if ((long) ee->ee_data + 1 > batch->zc_done)
+                batch->zc_done = (long) ee->ee_data + 1;
+        }
+    }
+#endif
+}
+
+/*
+ * zc_wait - wait until the kernel has released the buffers of the slot's
+ *      last MSG_ZEROCOPY send, so its header can be rewritten. The wait is
+ *      bounded: a header rewritten early at worst corrupts a datagram in
+ *      flight, which the server drops
+ */
+static void zc_wait(int sockfd, send_batch_t *batch, win_slot_t *slot) {
+    long long deadline = now_usec() + ZC_WAIT_USEC;
+
+    while (batch->zerocopy && slot->zc_id >= batch->zc_done) {
+        zc_reap(sockfd, batch);
+
+        long long wait = deadline - now_usec();
+
+        if (slot->zc_id < batch->zc_done || wait <= 0)
+            break;
+
+        /* error queue notifications are always reported as POLLERR */
+        struct pollfd pfd = { .fd = sockfd, .events = 0 };
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = wait * 1000 };
+
+        ppoll(&pfd, 1, &ts, NULL);
+    }
+}
+
+/*
+ * build_msgs - build the messages to send the segments queued in the batch
+ *      from the given one on, one per segment or one per run of segments 
+ *      the kernel can segment. Returns the number of messages
+ */
+static int build_msgs(send_batch_t *batch, int first) {
+    int count = 0;
+    int seg_max = batch->zerocopy ? ZC_GSO_SEGS_MAX : GSO_SEGS_MAX;
+
+    for (int i = first; i < batch->len; count++) {
+        struct msghdr *hdr = &batch->msgs[count].msg_hdr;
+        size_t seg_len = batch->seg_len[i];
+        size_t total = seg_len;
+        int n = 1;
+
+        while (batch->gso && i + n < batch->len && n < seg_max &&
+               batch->seg_len[i + n - 1] == seg_len && batch->seg_len[i + n] <= seg_len &&
+               total + batch->seg_len[i + n] <= GSO_BYTES_MAX)
+            total += batch->seg_len[i + n++];
+
+        hdr->msg_iov = &batch->iov[batch->seg_iov[i]];
+        hdr->msg_iovlen = (i + n < batch->len ? batch->seg_iov[i + n] : batch->iov_len) - batch->seg_iov[i];
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+
+#ifdef UDP_SEGMENT
+        if (n > 1) {
+            hdr->msg_control = batch->ctrl + count * GSO_CTRL_SIZE;
+            hdr->msg_controllen = GSO_CTRL_SIZE;
+
+            struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *) CMSG_DATA(cm) = (uint16_t) seg_len;
+        }
+#endif
+
+        i += n;
+    }
+
+    return count;
+}
+
+/* msg_first_seg - the index of the first queued segment a message carries */
+static int msg_first_seg(send_batch_t *batch, struct msghdr *hdr) {
+    int iov = (int) (hdr->msg_iov - batch->iov);
+    int i = 0;
+
+    while (batch->seg_iov[i] != iov)
+        i++;
+
+    return i;
+}
+
+/* 
+ * flush_batch - send the segments queued in the batch. If the kernel or the
+ *      device fails to segment a GSO message, GSO is turned off and the 
+ *      segments not sent yet are sent one per datagram. Each message sent
+ *      with MSG_ZEROCOPY gets the next send id, recorded in its slots
+ */
+static void flush_batch(int sockfd, int infd, send_batch_t *batch) {
+    int count = build_msgs(batch, 0);
+    int done = 0;
+    int flags = 0;
+
+#ifdef MSG_ZEROCOPY
+    if (batch->zerocopy)
+        flags = MSG_ZEROCOPY;
+#endif
+
+    while (done < count) {
+        int n = sendmmsg(sockfd, batch->msgs + done, count - done, flags);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            /* 
+             * no room to pin more pages (ENOBUFS) or too many fragments 
+             * (EMSGSIZE): send the rest of the batch by copy
+             */
+            if (flags && (errno == ENOBUFS || errno == EMSGSIZE)) {
+                flags = 0;
+                continue;
+            }
+
+            /* 
+             * the path MTU dropped below the segment size during the transfer,
+             * a GSO segment is not fragmented: it is sent as a datagram of its own
+             */
+            if (errno == EMSGSIZE && allow_fragments(sockfd))
+                continue;
+
+            if (batch->gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+                               errno == EOPNOTSUPP || errno == EMSGSIZE)) {
+                print_cmsg("UDP segmentation offload failed, sending one segment per datagram");
+                batch->gso = false;
+                count = build_msgs(batch, msg_first_seg(batch, &batch->msgs[done].msg_hdr));
+                done = 0;
+                continue;
+            }
+
+            close(infd);
+            close(sockfd);
+            exit_cerr(__LINE__, "Sending Payload error");
+        }
+
+        for (int i = done; i < done + n; i++) {
+            struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+            int first = msg_first_seg(batch, hdr);
+            int segs = 0;
+
+            for (int k = first; k < batch->len && batch->seg_iov[k] < (int) (hdr->msg_iov - batch->iov) +
+                                                  (int) hdr->msg_iovlen; k++, segs++) {
+                if (flags)
+                    batch->slots[k]->zc_id = batch->zc_sends;
+            }
+
+            if (flags)
+                batch->zc_sends++;
+
+            if (segs > 1) {
+                batch->gso_msgs++;
+                batch->gso_sent += segs;
+            }
+        }
+
+        done += n;
+        batch->calls++;
+    }
+
+    batch->sent += batch->len;
+    batch->len = 0;
+    batch->iov_len = 0;
+}
+
+/*
+ * queue_seg - queue the segment of a slot in the batch, as one iovec if its
+ *      payload follows its header or as its header and its payload in the 
+ *      mapping of the file. The batch is sent when full
+ */
+static void queue_seg(int sockfd, int infd, win_slot_t *slot, send_batch_t *batch) {
+    segment_t *seg = slot->seg;
+    size_t bytes = sizeof(segment_t) + seg->payload_bytes;
+    struct iovec *iov = &batch->iov[batch->iov_len];
+
+    batch->slots[batch->len] = slot;
+    batch->seg_iov[batch->len] = batch->iov_len;
+    batch->seg_len[batch->len] = bytes;
+
+    if (slot->data == seg->payload) {
+        iov[0].iov_base = seg;
+        iov[0].iov_len = bytes;
+        batch->iov_len++;
+    } else {
+        iov[0].iov_base = seg;
+        iov[0].iov_len = sizeof(segment_t);
+        iov[1].iov_base = slot->data;
+        iov[1].iov_len = seg->payload_bytes;
+        batch->iov_len += SEG_IOV_MAX;
+    }
+
+    if (++batch->len == batch->max)
+        flush_batch(sockfd, infd, batch);
+}
+
+/*
+ * send_window_seg - (re)send a segment of the send window with a checksum
+ *      corrupted with the given probability, restart the segment's timer
+ *      (it expires the current RTO after the time sent) and take its bytes
+ *      from the pacer's tokens. The segment is queued in the batch, which
+ *      is sent when full or flushed
+ */
+static void send_window_seg(int sockfd, int infd, win_slot_t *slot, float loss_prob,
+                            send_count_t *count, pacer_t *pacer, send_batch_t *batch) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t *seg = slot->seg;
+
+    zc_wait(sockfd, batch, slot);
+    seg->checksum = seg_checksum(batch->csum, seg, slot->data, is_corrupted(loss_prob));
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending segment with sq: %d, payload bytes: %zu, "
+                                        "checksum: %d", seg->sq, seg->payload_bytes, seg->checksum);
+    print_cmsg(inf_msg_buf);
+    queue_seg(sockfd, infd, slot, batch);
+
+    pacer->tokens -= sizeof(segment_t) + seg->payload_bytes;
+    slot->sent = now_usec();
+    slot->tx = count->tx++;
+    slot->delivered = count->delivered;
+    slot->delivered_time = count->delivered_time;
+}
+
+/*
+ * fec_add - XOR the payload of a data segment sent for the first time into
+ *      the parity of its block, starting a new block with the segment if 
+ *      there is none. The segment carries the sq of the first segment of 
+ *      its block. A new block adapts its size to the loss rate: segments 
+ *      lost (resent or recovered by the server) per transmission since the
+ *      last block started, smoothed
+ */
+static void fec_add(int sockfd, int infd, send_batch_t *batch, fec_sender_t *fec, win_slot_t *slot,
+                    long lost, long tx) {
+    segment_t *parity = fec->slot.seg;
+
+    if (!fec->count) {
+        if (fec->adapt && tx > fec->tx) {
+            fec->loss += ((double) (lost - fec->lost) / (tx - fec->tx) - fec->loss) * FEC_LOSS_GAIN;
+            fec->k = fec_block_size(fec->loss);
+        }
+
+        fec->lost = lost;
+        fec->tx = tx;
+        fec->first = slot->seg->sq;
+
+        /* 
+         * the last parity may still be queued in the batch, or be sent by 
+         * the kernel from its buffer
+         */
+        for (int i = 0; i < batch->len; i++) {
+            if (batch->slots[i] == &fec->slot) {
+                flush_batch(sockfd, infd, batch);
+                break;
+            }
+        }
+
+        zc_wait(sockfd, batch, &fec->slot);
+        memset(parity, 0x00, sizeof(segment_t) + fec->size);
+        parity->session = slot->seg->session;
+        parity->type = FEC_SEG;
+        parity->sq = fec->first;
+        parity->offset = slot->seg->offset;
+    }
+
+    slot->seg->ack = fec->first;
+    fec_xor(parity->payload, slot->data, slot->seg->payload_bytes);
+
+    if (slot->seg->payload_bytes > parity->payload_bytes)
+        parity->payload_bytes = slot->seg->payload_bytes;
+
+    fec->count++;
+}
+
+/*
+ * fec_send - send the parity of the block once the block is complete or
+ *      holds the last segment, with a checksum corrupted with the given 
+ *      probability like a data segment. The parity is paced but has no 
+ *      timer: it is never resent. Returns true if the parity was sent
+ */
+static bool fec_send(int sockfd, int infd, fec_sender_t *fec, bool last, float loss_prob,
+                     pacer_t *pacer, send_batch_t *batch) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t *parity = fec->slot.seg;
+
+    if (fec->count < fec->k && !last)
+        return false;
+
+    parity->ack = fec->count;
+    parity->checksum = seg_checksum(batch->csum, parity, parity->payload, is_corrupted(loss_prob));
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending parity segment for sq: %d to %d, payload bytes: %zu",
+             fec->first, fec->first + fec->count - 1, parity->payload_bytes);
+    print_cmsg(inf_msg_buf);
+    queue_seg(sockfd, infd, &fec->slot, batch);
+
+    pacer->tokens -= sizeof(segment_t) + parity->payload_bytes;
+    fec->sent++;
+
+    if (!fec->k_min || fec->count < fec->k_min)
+        fec->k_min = fec->count;
+
+    if (fec->count > fec->k_max)
+        fec->k_max = fec->count;
+
+    fec->count = 0;
+
+    return true;
+}
+
+/*
+ * See documentation in rft_client_util.h
+ * Hints:
+ *  - Remember to output appropriate information messages for the user to 
+ *      follow progress of the transfer
+ *  - Remember in this function you can exit with an error as long as you 
+ *      close open resources you are given.
+ *  - Look at server code.
+ */
+size_t send_file_with_timeout(int sockfd, struct sockaddr_in *server, int infd,
+                              size_t bytes_to_read, float loss_prob, tfr_opts_t *opts) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    size_t chunk = opts->payload_size;      // file bytes per segment
+    int seg_count = (int) ((bytes_to_read + chunk - 1) / chunk);
+    int window = opts->window;
+    int base = 0;                       // oldest unacknowledged sq
+    int next_sq = 0;                    // next sq to send for the first time
+    int resent = 0;
+    int sack_resent = 0;
+    int inflight = 0;                   // segments sent and not ACKed
+    int recover = 0;                    // sq sent next when the last loss
+                                        // was reported to congestion control
+    long acked_tx = -1;                 // latest transmission that was ACKed
+    send_count_t count = { .tx = 0, .delivered = 0, .delivered_time = now_usec() };
+    rtt_est_t rtt = { .srtt = 0, .rttvar = 0, .rto = RTO_INIT_USEC };
+    cc_state_t cc;
+    pacer_t pacer = { .rate = 0, .tokens = 0, .stamp = 0, .delays = 0 };
+    send_batch_t batch = { .len = 0, .iov_len = 0, .max = opts->batch, .gso = opts->gso,
+                           .zerocopy = false, .csum = opts->csum, .calls = 0, .sent = 0, .gso_msgs = 0, .gso_sent = 0,
+                           .zc_sends = 0, .zc_done = 0, .zc_copied = 0 };
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+    fec_sender_t fec = { .k = opts->fec == FEC_AUTO ? FEC_K_MAX : opts->fec, .adapt = opts->fec == FEC_AUTO,
+                         .size = opts->payload_size, .loss = 0, .lost = 0, .tx = 0, .recovered = 0,
+                         .sent = 0, .k_min = 0, .k_max = 0 };
+    compressor_t z = { .on = true, .buf = opts->compress ? malloc(opts->payload_size) : NULL };
+    file_reader_t reader;
+    xxh64_state_t digest;
+
+    xxh64_init(&digest, 0);
+
+    /* 
+     * segments sent from the mapping of the file only keep their header,
+     * unless their payload may be compressed
+     */
+    if (opts->tree)
+        reader_open_tree(&reader, infd, opts->tree);
+    else
+        reader_open(&reader, infd, opts->range_offset + bytes_to_read, opts->use_mmap);
+
+    bool mapped = reader_map(&reader, 0) != NULL;
+    size_t seg_size = sizeof(segment_t) + (mapped && !opts->compress ? 0 : opts->payload_size);
+    win_slot_t *slots = calloc(window, sizeof(win_slot_t));
+    char *seg_buf = malloc(window * seg_size);
+    segment_t *ack_rec = malloc(ACK_SIZE);
+
+    batch.msgs = calloc(batch.max, sizeof(struct mmsghdr));
+    batch.iov = calloc(batch.max * SEG_IOV_MAX, sizeof(struct iovec));
+    batch.slots = calloc(batch.max, sizeof(win_slot_t *));
+    batch.seg_iov = calloc(batch.max, sizeof(int));
+    batch.seg_len = calloc(batch.max, sizeof(size_t));
+    batch.ctrl = calloc(batch.max, GSO_CTRL_SIZE);
+
+    /* the parity segment of a block of FEC, sent from its own buffer */
+    if (fec.k) {
+        fec.slot.seg = malloc(sizeof(segment_t) + fec.size);
+        fec.slot.data = fec.slot.seg ? fec.slot.seg->payload : NULL;
+        fec.slot.zc_id = -1;
+    }
+
+    if (!slots || !seg_buf || !ack_rec || !batch.msgs || !batch.iov || !batch.slots ||
+        !batch.seg_iov || !batch.seg_len || !batch.ctrl || (fec.k && !fec.slot.seg) ||
+        (opts->compress && !z.buf)) {
+        close(infd);
+        close(sockfd);
+        exit_cerr(__LINE__, "Failed to allocate send window");
+    }
+
+    for (int i = 0; i < window; i++) {
+        slots[i].seg = (segment_t *) (seg_buf + i * seg_size);
+        slots[i].zc_id = -1;
+    }
+
+    for (int i = 0; i < batch.max; i++) {
+        batch.msgs[i].msg_hdr.msg_name = server;
+        batch.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    if (batch.gso && !gso_supported(sockfd)) {
+        print_cmsg("UDP segmentation offload not supported, sending one segment per datagram");
+        batch.gso = false;
+    }
+
+    if (opts->zerocopy && mapped) {
+        batch.zerocopy = enable_zerocopy(sockfd);
+
+        if (!batch.zerocopy)
+            print_cmsg("MSG_ZEROCOPY not supported, the kernel copies segments");
+    }
+
+    cc_init(&cc, opts->cc, window, opts->payload_size);
+    pacer.burst = (double) opts->pace_burst * (sizeof(segment_t) + opts->payload_size);
+
+    while (base < seg_count) {
+        /* 
+         * fill the window with segments not sent yet, keeping no more in 
+         * flight than congestion control allows
+         */
+        long long pace_at = LLONG_MAX;      // time the pacer lets the next segment go
+
+        pacer_update(&pacer, cc.pacing_rate * opts->pace_gain, now_usec());
+
+        while (next_sq < seg_count && next_sq < base + window && inflight < (int) cc.cwnd) {
+            win_slot_t *slot = &slots[next_sq % window];
+            size_t offset = (size_t) next_sq * chunk;   // offset in the range
+            size_t len = bytes_to_read - offset < chunk ? bytes_to_read - offset : chunk;
+            long long delay = pacer_delay(&pacer, sizeof(segment_t) + len);
+
+            if (delay) {
+                pace_at = pacer.stamp + delay;
+                pacer.delays++;
+                break;
+            }
+
+            zc_wait(sockfd, &batch, slot);
+
+            /* 
+             * the file streams through the window: read the chunk into its 
+             * slot, or send it straight from the mapping of the file
+             */
+            if (mapped) {
+                slot->data = reader_map(&reader, opts->range_offset + offset);
+            } else if (reader_read(&reader, opts->range_offset + offset, slot->seg->payload, len) ==
+                       (ssize_t) len) {
+                slot->data = slot->seg->payload;
+            } else {
+                errno = ENODATA;
+                close(infd);
+                close(sockfd);
+                exit_cerr(__LINE__, "Failed to read file");
+            }
+
+            /* the digest takes each chunk as it enters the window, in offset order */
+            xxh64_update(&digest, slot->data, len);
+            memset(slot->seg, 0x00, sizeof(segment_t));
+            slot->seg->session = opts->session;
+            slot->seg->sq = next_sq;
+            slot->seg->type = DATA_SEG;
+            slot->seg->last = next_sq == seg_count - 1;
+            slot->seg->payload_bytes = len;
+            slot->seg->offset = opts->range_offset + offset;
+            slot->acked = false;
+            slot->resent = false;
+            slot->fec_tx = fec.k ? LONG_MAX : -1;
+
+            /* the server holds ACKs back for more segments unless the window is full */
+            slot->seg->ack_now = inflight + 1 >= (int) cc.cwnd || next_sq + 1 >= base + window;
+
+            if (fec.k)
+                fec_add(sockfd, infd, &batch, &fec, slot, resent + sack_resent + fec.recovered, count.tx);
+
+            /* a payload that shrinks is sent compressed, from its slot */
+            if (opts->compress && compress_seg(&z, slot->seg, slot->data)) {
+                memcpy(slot->seg->payload, z.buf, slot->seg->payload_bytes);
+                slot->data = slot->seg->payload;
+            }
+
+            send_window_seg(sockfd, infd, slot, loss_prob, &count, &pacer, &batch);
+
+            /* the segments of the block wait for the parity before a resend */
+            if (fec.k && fec_send(sockfd, infd, &fec, next_sq == seg_count - 1, loss_prob, &pacer, &batch)) {
+                for (int sq = fec.first; sq <= next_sq; sq++)
+                    slots[sq % window].fec_tx = count.tx;
+            }
+
+            next_sq++;
+            inflight++;
+        }
+
+        flush_batch(sockfd, infd, &batch);
+
+        /* 
+         * wait for an ACK until the first timer in the window expires or the
+         * pacer lets the next segment go
+         */
+        long long deadline = pace_at;
+
+        for (int sq = base; sq < next_sq; sq++) {
+            win_slot_t *slot = &slots[sq % window];
+
+            if (!slot->acked && slot->sent + rtt.rto < deadline)
+                deadline = slot->sent + rtt.rto;
+        }
+
+        long long wait = deadline - now_usec();
+
+        /* 
+         * ACKs are read even when nothing needs waiting for, all that have 
+         * arrived before the window is filled again
+         */
+        if (wait < 0)
+            wait = 0;
+        else if (deadline == LLONG_MAX)
+            wait = RTO_MAX_USEC;
+
+        while (wait_readable(sockfd, wait)) {
+            wait = 0;
+            memset(ack_rec, 0, ACK_SIZE);
+            ssize_t ack_bytes = recvfrom(sockfd, ack_rec, ACK_SIZE, MSG_DONTWAIT,
+                                         (struct sockaddr *) server, &addr_len);
+
+            if (ack_bytes < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    close(sockfd);
+                    close(infd);
+                    exit_cerr(__LINE__, "ACK Receive Failure");
+                }
+
+                /* woken by MSG_ZEROCOPY completions rather than an ACK */
+                zc_reap(sockfd, &batch);
+            } else if (!ack_bytes) {
+                errno = ENOMSG;
+                close(sockfd);
+                close(infd);
+                exit_cerr(__LINE__, "Ending connection - no ACK received");
+            } else if (ack_rec->type == ACK_SEG && ack_rec->session == opts->session &&
+                       ack_rec->ack <= next_sq &&
+                       ack_bytes >= (ssize_t) (sizeof(segment_t) + ack_rec->payload_bytes)) {
+                snprintf(inf_msg_buf, INF_MSG_SIZE, "ACK with sq: %d, cumulative ACK: %d Received",
+                         ack_rec->sq, ack_rec->ack);
+                print_cmsg(inf_msg_buf);
+
+                /* the server reports the segments it recovered from parity */
+                if (ack_rec->offset > fec.recovered)
+                    fec.recovered = ack_rec->offset;
+
+                cc_sample_t rs = { .acked = 0, .rtt = 0, .delivery_rate = 0, .now = now_usec() };
+                win_slot_t *latest = NULL;      // most recently sent of the ACKed segments
+
+                /* segments below the cumulative ACK and those selectively ACKed */
+                for (int sq = base; sq < next_sq; sq++) {
+                    win_slot_t *slot = &slots[sq % window];
+                    int bit = sq - ack_rec->ack - 1;
+
+                    if (!slot->acked && (sq < ack_rec->ack || sq == ack_rec->sq ||
+                                         (bit >= 0 && bit < (int) ack_rec->payload_bytes * 8 &&
+                                          sack_isset(ack_rec->payload, bit)))) {
+                        slot->acked = true;
+
+                        rs.acked++;
+
+                        if (!latest || slot->tx > latest->tx)
+                            latest = slot;
+
+                        /* RTT sample from the segment the server ACKs */
+                        if (sq == ack_rec->sq && !slot->resent) {
+                            rs.rtt = rs.now - slot->sent;
+                            rtt_sample(&rtt, rs.rtt);
+                        }
+
+                        /* 
+                         * only an ACK of a segment sent once tells which
+                         * transmission got through
+                         */
+                        if (!slot->resent && slot->tx > acked_tx)
+                            acked_tx = slot->tx;
+                    }
+                }
+
+                /* slide the window past the segments ACKed in sequence */
+                while (base < next_sq && slots[base % window].acked)
+                    base++;
+
+                /* delivery rate over the time the latest segment was in flight */
+                if (rs.acked) {
+                    inflight -= rs.acked;
+                    count.delivered += rs.acked;
+
+                    if (rs.now > latest->delivered_time)
+                        rs.delivery_rate = (count.delivered - latest->delivered) * 1e6 /
+                                           (rs.now - latest->delivered_time);
+
+                    count.delivered_time = rs.now;
+                    rs.inflight = inflight;
+                    rs.delivered = count.delivered;
+                    rs.prior_delivered = latest->delivered;
+                    rs.srtt = rtt.srtt;
+                    opts->cc->on_ack(&cc, &rs);
+                }
+
+                /* 
+                 * resend the holes the ACK reports: segments still not ACKed 
+                 * although DUP_THRESH segments sent after them were. With
+                 * FEC a segment sent once is only a hole once DUP_THRESH
+                 * segments sent after the parity of its block were ACKed,
+                 * the server may recover it from the parity
+                 */
+                for (int sq = base; sq < next_sq; sq++) {
+                    win_slot_t *slot = &slots[sq % window];
+                    long sent_tx = slot->resent || slot->fec_tx < slot->tx ? slot->tx : slot->fec_tx;
+
+                    if (!slot->acked && sent_tx <= acked_tx - DUP_THRESH) {
+                        snprintf(inf_msg_buf, INF_MSG_SIZE, "SACK hole resending segment with sq: %d", sq);
+                        print_cmsg(inf_msg_buf);
+
+                        /* one congestion signal per window of data */
+                        if (sq >= recover) {
+                            opts->cc->on_loss(&cc, rs.now);
+                            recover = next_sq;
+                        }
+
+                        slot->resent = true;
+                        send_window_seg(sockfd, infd, slot, loss_prob, &count, &pacer, &batch);
+                        sack_resent++;
+                    }
+                }
+            }
+        }
+
+        /* 
+         * resend only the segments whose timer has expired, backing off the 
+         * RTO once for all of them
+         */
+        long long now = now_usec();
+        long long rto = rtt.rto;
+        bool timed_out = false;
+
+        for (int sq = base; sq < next_sq; sq++) {
+            win_slot_t *slot = &slots[sq % window];
+
+            if (!slot->acked && slot->sent + rto <= now) {
+                snprintf(inf_msg_buf, INF_MSG_SIZE, "TIMEOUT reached resending segment with sq: %d", sq);
+                print_cmsg(inf_msg_buf);
+                slot->resent = true;
+                send_window_seg(sockfd, infd, slot, loss_prob, &count, &pacer, &batch);
+                resent++;
+                timed_out = true;
+            }
+        }
+
+        /* send the holes and the segments resent on timeout together */
+        flush_batch(sockfd, infd, &batch);
+
+        if (timed_out) {
+            rtt_backoff(&rtt);
+            opts->cc->on_timeout(&cc, now);
+            recover = next_sq;
+        }
+    }
+
+    free(slots);
+    free(seg_buf);
+    free(fec.slot.seg);
+    free(z.buf);
+    free(ack_rec);
+    free(batch.msgs);
+    free(batch.iov);
+    free(batch.slots);
+    free(batch.seg_iov);
+    free(batch.seg_len);
+    free(batch.ctrl);
+    print_sep();
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Total segments sent: %d (%d resent on timeout, %d on SACK)",
+             seg_count + resent + sack_resent, resent, sack_resent);
+    print_cmsg(inf_msg_buf);
+
+    if (fec.k) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Forward error correction: %ld parity segments for blocks of %d to "
+                                            "%d segments, %ld segments recovered by the server",
+                 fec.sent, fec.k_min, fec.k_max, fec.recovered);
+        print_cmsg(inf_msg_buf);
+
+        if (fec.adapt) {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, "Smoothed loss rate: %.3f, segments per parity segment: %d",
+                     fec.loss, fec.k);
+            print_cmsg(inf_msg_buf);
+        }
+    }
+
+    if (opts->compress)
+        print_compress(&z);
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Segments sent in %ld sendmmsg calls (%.2f segments per call, "
+                                        "batch size: %d)",
+             batch.calls, batch.calls ? (double) batch.sent / batch.calls : 0, batch.max);
+    print_cmsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "UDP segmentation offload: %s, %ld segments sent in %ld GSO buffers",
+             batch.gso ? "on" : "off", batch.gso_sent, batch.gso_msgs);
+    print_cmsg(inf_msg_buf);
+
+    if (batch.zerocopy) {
+        zc_reap(sockfd, &batch);
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "MSG_ZEROCOPY: %ld sends, %ld completed (%ld copied by the kernel)",
+                 batch.zc_sends, batch.zc_done, batch.zc_copied);
+        print_cmsg(inf_msg_buf);
+    }
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Smoothed RTT: %lld usec, RTT variation: %lld usec, RTO: %lld usec",
+             rtt.srtt, rtt.rttvar, rtt.rto);
+    print_cmsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Congestion control: %s, cwnd: %.1f segments, ssthresh: %.1f segments, "
+                                        "pacing rate: %.0f bytes/sec",
+             opts->cc->name, cc.cwnd, cc.ssthresh, cc.pacing_rate);
+    print_cmsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Pacing gain: %.2f, burst: %d segments, segments held back by pacing: %d",
+             opts->pace_gain, opts->pace_burst, pacer.delays);
+    print_cmsg(inf_msg_buf);
+    reader_close(&reader);
+
+    if (!confirm_digest(sockfd, server, opts->script ? &opts->script->digest : &digest, opts)) {
+        close(infd);
+        close(sockfd);
+        exit_cerr(__LINE__, "Server did not confirm the digest of the transfer");
+    }
+
+    close(sockfd);
+    close(infd);
+    return bytes_to_read;
+}
+
+/* a parallel transfer: the ranges of the file and the next one to send */
+typedef struct range_job {
+    char *server_addr;          // address and port of the server
+    int port;
+    int infd;                   // the input file, each range sends a dup
+    size_t file_size;
+    char *output_file;
+    bool with_timeout;          // wt transfer mode, else nm
+    float loss_prob;
+    tfr_opts_t *opts;           // options of the transfer
+    size_t range_size;          // bytes per range (the last of a part of the file may be shorter)
+    journal_range_t *ranges;    // ranges of the file to send
+    long count;                 // ranges to send
+    long next_range;            // next range to send (atomic)
+} range_job_t;
+
+/* a stream of a parallel transfer sending ranges one after the other */
+typedef struct stream {
+    pthread_t thread;
+    int index;
+    range_job_t *job;
+    size_t bytes;               // bytes sent
+    int payload_size;           // payload size used for the ranges
+} stream_t;
+
+/* take the next range of the job and send it, until there are none left */
+static void *send_stream(void *arg) {
+    stream_t *st = arg;
+    range_job_t *job = st->job;
+    char inf_msg_buf[INF_MSG_SIZE];
+    tfr_opts_t opts = *job->opts;
+    bool probed = false;
+    long r;
+
+    while ((r = __atomic_fetch_add(&job->next_range, 1, __ATOMIC_RELAXED)) < job->count) {
+        struct sockaddr_in server;
+        int sockfd = create_udp_socket(&server, job->server_addr, job->port);
+        int infd = dup(job->infd);
+
+        if (sockfd == -1 || infd < 0)
+            exit_cerr(__LINE__, "Failed to open stream");
+
+        /* each range is a session of its own with its own sequence space */
+        opts.session = new_session_id();
+        opts.range_offset = job->ranges[r].start;
+        opts.range_bytes = job->ranges[r].end - job->ranges[r].start;
+
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Stream %d: sending bytes %ld to %ld in session %u", st->index,
+                 (long) opts.range_offset, (long) (opts.range_offset + opts.range_bytes - 1), opts.session);
+        print_cmsg(inf_msg_buf);
+
+        if (!send_metadata(sockfd, &server, job->file_size, job->output_file, &opts)) {
+            close(infd);
+            exit_cerr(__LINE__, "Sending meta data failed");
+        }
+
+        /* the path is the same for all ranges of the stream */
+        if (!probed) {
+            probe_payload_size(sockfd, &server, &opts);
+            probed = true;
+        }
+
+        if (job->with_timeout)
+            st->bytes += send_file_with_timeout(sockfd, &server, infd, opts.range_bytes, job->loss_prob, &opts);
+        else
+            st->bytes += send_file_normal(sockfd, &server, infd, opts.range_bytes, &opts);
+
+        st->payload_size = opts.payload_size;
+    }
+
+    return NULL;
+}
+
+/*
+ * See documentation in rft_client_util.h
+ */
+size_t send_file_parallel(char *server_addr, int port, int infd, size_t file_size, char *output_file,
+                          bool with_timeout, float loss_prob, tfr_opts_t *opts) {
+    range_job_t job = { .server_addr = server_addr, .port = port, .infd = infd, .file_size = file_size,
+                        .output_file = output_file, .with_timeout = with_timeout, .loss_prob = loss_prob,
+                        .opts = opts, .next_range = 0 };
+    char inf_msg_buf[INF_MSG_SIZE];
+    size_t bytes = 0;
+    journal_range_t whole = { .start = 0, .end = (off_t) file_size };
+    journal_range_t *parts = opts->missing ? opts->missing : &whole;    // parts of the file to send
+    int nparts = opts->missing ? opts->nmissing : 1;
+    size_t part_bytes = 0;
+
+    for (int i = 0; i < nparts; i++)
+        part_bytes += parts[i].end - parts[i].start;
+
+    /* each part of the file is split into ranges */
+    job.range_size = opts->range_size ? opts->range_size : (part_bytes + opts->streams - 1) / opts->streams;
+    job.count = 0;
+
+    for (int i = 0; i < nparts; i++)
+        job.count += (long) ((parts[i].end - parts[i].start + job.range_size - 1) / job.range_size);
+
+    job.ranges = malloc(job.count * sizeof(journal_range_t));
+
+    for (int i = 0, r = 0; job.ranges && i < nparts; i++) {
+        for (off_t off = parts[i].start; off < parts[i].end; off += job.range_size, r++) {
+            job.ranges[r].start = off;
+            job.ranges[r].end = parts[i].end - off < (off_t) job.range_size ? parts[i].end :
+                                off + (off_t) job.range_size;
+        }
+    }
+
+    int streams = opts->streams < job.count ? opts->streams : (int) job.count;
+    stream_t *st = calloc(streams, sizeof(stream_t));
+
+    if (!st || !job.ranges) {
+        close(infd);
+        exit_cerr(__LINE__, "Failed to allocate streams");
+    }
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending %ld ranges of %zu bytes over %d streams", job.count,
+             job.range_size, streams);
+    print_cmsg(inf_msg_buf);
+
+    for (int i = 0; i < streams; i++) {
+        st[i].index = i + 1;
+        st[i].job = &job;
+        st[i].payload_size = opts->payload_size;
+
+        if (pthread_create(&st[i].thread, NULL, send_stream, &st[i])) {
+            errno = EAGAIN;
+            close(infd);
+            exit_cerr(__LINE__, "Failed to start stream");
+        }
+    }
+
+    for (int i = 0; i < streams; i++) {
+        pthread_join(st[i].thread, NULL);
+        bytes += st[i].bytes;
+    }
+
+    opts->payload_size = st[0].payload_size;
+    free(st);
+    free(job.ranges);
+    close(infd);
+    return bytes;
+}
+
+/*
+ * See documentation in rft_client_util.h
+ */
+int resume_ranges(char *server_addr, int port, off_t file_size, char *output_file, tfr_opts_t *opts,
+                  journal_range_t *missing) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    size_t req_size = sizeof(segment_t) + sizeof(resume_req_t);
+    size_t reply_size = sizeof(segment_t) + sizeof(resume_t);
+    segment_t *req = calloc(1, req_size);
+    segment_t *reply = malloc(reply_size);
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+    struct sockaddr_in server;
+    int sockfd = create_udp_socket(&server, server_addr, port);
+    resume_req_t ask;
+    resume_t durable;
+    bool replied = false;
+
+    memset(&ask, 0, sizeof(resume_req_t));
+    strncpy(ask.name, output_file, FILE_NAME_SIZE - 1);
+    ask.size = file_size;
+    ask.source = opts->source;
+
+    for (int tries = 0; req && reply && sockfd >= 0 && !replied && tries < RESUME_RETRIES; tries++) {
+        req->session = opts->session;
+        req->sq = tries;
+        req->type = RESUME_SEG;
+        req->payload_bytes = sizeof(resume_req_t);
+        memcpy(req->payload, &ask, sizeof(resume_req_t));
+
+        if (sendto(sockfd, req, req_size, 0, (struct sockaddr *) &server, sizeof(struct sockaddr_in)) < 0)
+            break;
+
+        long long deadline = now_usec() + RESUME_TIMEOUT_USEC;
+        long long wait;
+
+        while (!replied && (wait = deadline - now_usec()) > 0 && set_rcv_timeout(sockfd, wait)) {
+            ssize_t bytes = recvfrom(sockfd, reply, reply_size, 0, (struct sockaddr *) &server, &addr_len);
+
+            if (bytes < 0)
+                break;
+
+            replied = bytes == (ssize_t) reply_size && reply->type == RESUME_SEG &&
+                      reply->session == opts->session;
+        }
+    }
+
+    if (replied)
+        memcpy(&durable, reply->payload, sizeof(resume_t));
+
+    free(req);
+    free(reply);
+
+    if (sockfd >= 0)
+        close(sockfd);
+
+    if (!replied) {
+        print_cmsg("Server did not reply to the resume request, sending the file");
+        return -1;
+    }
+
+    /* the ranges must be in order and apart, anything else counts as none */
+    off_t have = 0;
+    off_t prev = -1;
+
+    for (int i = 0; i < durable.count && durable.count <= RESUME_RANGES_MAX; i++) {
+        journal_range_t *d = &durable.ranges[i];
+
+        if (d->start <= prev || d->start >= d->end || d->end > file_size) {
+            durable.count = 0;
+            break;
+        }
+
+        have += d->end - d->start;
+        prev = d->end;
+    }
+
+    if (durable.count <= 0 || durable.count > RESUME_RANGES_MAX) {
+        print_cmsg("Server has none of this version of the file on disk, sending the file");
+        return -1;
+    }
+
+    /* the gaps between the ranges on disk */
+    int n = 0;
+    off_t from = 0;
+
+    for (int i = 0; i <= durable.count; i++) {
+        off_t to = i < durable.count ? durable.ranges[i].start : file_size;
+
+        if (from < to) {
+            missing[n].start = from;
+            missing[n].end = to;
+            n++;
+        }
+
+        if (i < durable.count)
+            from = durable.ranges[i].end;
+    }
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Resuming transfer: server has %ld of %ld bytes of the file on disk in "
+                                        "%d ranges, %d ranges to send", (long) have, (long) file_size,
+             durable.count, n);
+    print_cmsg(inf_msg_buf);
+
+    return n;
+}
+
+/*
+ * See documentation in rft_client_util.h
+ */
+uint32_t new_session_id() {
+    static uint32_t count = 0;
+    uint64_t seed = (uint64_t) now_usec() ^ (uint64_t) getpid() << 32 ^
+                    (uint64_t) __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED) << 48;
+
+    /* mixed so that all of its bits differ, the server steers by them */
+    return (uint32_t) ((seed * 0x9e3779b97f4a7c15ULL) >> 32);
+}
@@ -1,7 +1,69 @@
 #ifndef _RFT_CLIENT_H
+#define _RFT_CLIENT_H
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <netinet/in.h> // for sockaddr_in
+#include "rft_cc.h"
+#include "rft_tree.h"
+#include "rft_csum.h"
+#include "rft_fec.h"
+#include "rft_lz.h"
+#include "rft_delta.h"
+#include "rft_journal.h"
+
+/* options for the transfer set from command line arguments */
+typedef struct tfr_opts {
+    int window;         // max number of unacknowledged segments in flight
+    int payload_size;   // max payload bytes of data segments,
+                        // proposed to the server and set to the size the
+                        // server agreed to by send_metadata
+    cc_ops_t* cc;       // congestion control algorithm
+    int pace_burst;     // segments the pacer lets go back to back
+    double pace_gain;   // multiple of the congestion control pacing rate
+                        // to pace segments at, 0 to send unpaced
+    int batch;          // max segments sent with one sendmmsg call
+    bool gso;           // let the kernel split runs of segments into
+                        // datagrams (UDP GSO) where supported
+    bool use_mmap;      // map the input file rather than read it, wt mode
+                        // sends segments straight from the mapping
+    bool zerocopy;      // send from the mapping with MSG_ZEROCOPY
+    uint32_t session;   // session id of the transfer, carried by every
+                        // segment so the server can tell it from others
+    int streams;        // ranges of the file sent at the same time
+    size_t range_size;  // bytes per range, 0 for one range per stream
+    size_t range_offset;    // file offset of the range the session sends
+    size_t range_bytes;     // bytes in the range the session sends
+    tree_t* tree;       // the directory tree sent, NULL when a file is sent
+    int csum;           // checksum algorithm of data segments, proposed to
+                        // the server and set to the one the server agreed
+                        // to by send_metadata
+    int fec;            // data segments per parity segment in wt mode, 
+                        // FEC_AUTO to follow the loss rate, 0 for none 
+                        // (also set by send_metadata if the server does
+                        // not agree to parity segments)
+    bool compress;      // compress the payloads of data segments that 
+                        // shrink, cleared by send_metadata if the server
+                        // does not agree
+    bool delta;         // send a delta against the server's copy of the
+                        // file if it has one
+    delta_t* script;    // the delta script sent in place of the file, NULL
+                        // when the file itself is sent
+    bool resume;        // resume a transfer of the file that was cut off
+                        // and have the server keep a journal of the file
+                        // so that this one can be resumed
+    uint64_t source;    // identity of the version of the file for the 
+                        // server to keep a journal of it on disk, so that
+                        // the transfer can be resumed, 0 for none (also 
+                        // set by send_metadata if the server does not 
+                        // agree)
+    int ack_every;      // max data segments in sequence the server may 
+                        // ACK at once, 1 to ACK each (set to the number 
+                        // the server agreed to by send_metadata)
+    journal_range_t* missing;   // ranges of the file a resumed transfer
+                                // sends, NULL to send all of it
+    int nmissing;       // ranges in missing
+} tfr_opts_t;
 
 /*
  * INTRODUCTION AND WHAT YOU HAVE TO DO
@@ -45,8 +107,11 @@
 int create_udp_socket(struct sockaddr_in* server, char* server_addr, int port);
 
 /* 
- * send_metadata - send metadata (file size and file name to create) using 
- *      the given open socket to the server identified by the given sockaddr.
+ * send_metadata - send metadata (file size, file name to create and 
+ *      proposed payload size) using the given open socket to the server 
+ *      identified by the given sockaddr and wait for the server's reply
+ *      with the payload size it agreed to. The metadata is sent again if
+ *      no reply arrives within META_TIMEOUT_USEC, up to META_RETRIES times.
  *  
  *      This function does NOT print any information or error messages.
  *      If sending metadata fails, this function closes open resources 
@@ -60,14 +125,42 @@ int create_udp_socket(struct sockaddr_in* server, char* server_addr, int port);
  * output_file - the name of the file that the server will create for output
  *      of the data to be sent by the client (it will be a copy of the client's
  *      file)
+ * opts - transfer options, opts->payload_size is the payload size to propose
+ *      and is set to the payload size agreed by the server, opts->session 
+ *      is the session id of the transfer and opts->range_offset and
+ *      opts->range_bytes the range of the file it sends
  *
  * Return:
- * True if the metadata was successfully sent, false otherwise (and the 
- *      the function closes open resources passed to it)
+ * True if the metadata was successfully sent and the server replied, false 
+ *      otherwise (and the the function closes open resources passed to it)
  */
 bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size, 
-    char* output_file);
+    char* output_file, tfr_opts_t* opts);
     
+/* 
+ * probe_payload_size - find the largest payload size up to the size agreed
+ *      with the server for which data segments get through to the server 
+ *      without IP fragmentation (path MTU discovery).
+ *
+ *      Probe segments padded to a candidate payload size are sent with the
+ *      DF bit set and the server echoes each probe it receives. The search
+ *      starts at the agreed size and moves up when a probe is echoed and 
+ *      down when it is lost (no echo within PROBE_TIMEOUT_USEC after 
+ *      PROBE_RETRIES tries) or is too large for the local interface 
+ *      (EMSGSIZE). PAYLOAD_SIZE is assumed to get through.
+ *
+ *      As a by-product of this function information messages are printed
+ *      for each probe.
+ *
+ * Parameters:
+ * sockfd - the socket file descriptor to use (created by create_udp_socket)
+ * server - the server sockaddr struct (filled out by create_udp_socket)
+ * opts - transfer options, opts->payload_size is the payload size agreed 
+ *      with the server and is set to the largest size that got through
+ */
+void probe_payload_size(int sockfd, struct sockaddr_in* server, 
+    tfr_opts_t* opts);
+
 /* 
  * send_file_normal - send the file represented by the given open file 
  *      descriptor, using the given open socket to the server identified 
@@ -76,11 +169,27 @@ bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size,
  *
  *      The file is sent in chunks as payload to a succession of one or 
  *      more data segments. The number of segments required is determined 
- *      by the size of the file.
+ *      by the size of the file and the payload size agreed with the server.
+ *      Each chunk is read from the file just before its segment is sent 
+ *      (or copied from a mapping of the file if opts->use_mmap is set), so
+ *      the memory used does not depend on the size of the file.
+ *
+ *      Chunks are sent as they are, any bytes (text or binary). The 
+ *      payload_bytes of a segment is the length of its chunk and the 
+ *      server writes exactly that many bytes.
+ *
+ *      The bytes sent are the range of bytes_to_read bytes of the file at
+ *      opts->range_offset (0 to send the whole file). If opts->tree is set,
+ *      infd is the directory of the tree and the bytes sent are the stream
+ *      of the tree: its manifest and the content of its files. If 
+ *      opts->script is set, infd is the delta script built by make_delta.
  *
- *      THE SERVER EXPECTS EACH CHUNK OF A FILE TO BE A CORRECTLY TERMINATED
- *      STRING. This function must guarantee this property for the payload
- *      it sends.
+ *      The bytes are hashed as they are read (xxHash64, in offset order).
+ *      Once the server has them all, a DIGEST_SEG with the digest and the
+ *      byte count is sent and the server replies with its own digest of
+ *      the bytes it wrote (for a delta script, the digest of the file and
+ *      of the file the server rebuilt); the client exits with an error if 
+ *      the two differ or no reply comes after DIGEST_RETRIES tries.
  *
  *      The main client function does not call send_file_normal if infd is
  *      empty.
@@ -103,43 +212,93 @@ bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size,
  *      server
  * bytes_to_read - the number of bytes expected to be read form the file
  *      (initialised to the file size)
+ * opts - transfer options (payload size agreed with the server)
  *
  * Return:
  * On success: the number of bytes sent to the server
  * On failure: the function causes exit of the client with an error message
  */
 size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd, 
-    size_t bytes_to_read);
+    size_t bytes_to_read, tfr_opts_t* opts);
 
 /* 
  * send_file_with_timeout - send the file represented by the given open file 
  *      descriptor, using the given open socket to the server identified 
  *      by the given sockaddr struct. The function returns the number of 
  *      bytes sent to the server.
- *      This function is essentially the same as the send_file_normal function
- *      except that it resends data segments if no ACK for a segment is 
- *      received from the server. The function implements this as follows:
+ *      Unlike send_file_normal this function does not wait for the ACK of
+ *      each segment before sending the next one. It keeps a window of up to
+ *      opts->window unacknowledged segments in flight (selective repeat)
+ *      and resends a data segment if no ACK for it is received from the
+ *      server in time. The function implements this as follows:
  *      (i) it simulates network corruption or loss of data segments by
  *          injecting corruption into segment checksums (using the combination
  *          of the is_corrupted and checksum functions provided). The 
  *          probability of loss/corruption is determined by the loss_prob
  *          parameter.
- *      (ii) it times out when waiting to receive an ACK from the server
- *          for a data segment. The server does not ACK corrupted segments.
- *          Therefore, this client function will timeout waiting for an ACK 
- *          for a corrupted segment. When the timeout expires, the 
- *          function resends the data segment.
+ *      (ii) each segment in the window has its own timer. The server does 
+ *          not ACK corrupted segments. Therefore, the timer of a corrupted
+ *          segment expires and the function resends just that segment while
+ *          the rest of the window stays in flight. The timeout (RTO) is 
+ *          computed from the round trip times measured for ACKed segments
+ *          that were not resent (smoothed RTT plus four times its variation,
+ *          clamped to RTO_MIN_USEC..RTO_MAX_USEC) and doubles on each
+ *          timeout until the next measurement.
+ *      (iii) the number of segments in flight is limited by the congestion
+ *          window of the congestion control algorithm opts->cc as well as
+ *          by the send window. The algorithm is told about every ACK, 
+ *          about the first hole per window of data and about timeouts.
+ *      (iv) the window advances past the oldest unacknowledged segment as
+ *          soon as it is ACKed. Each segment carries the file offset of its
+ *          chunk and the server writes it there as soon as it arrives, in
+ *          any order; a segment it has already written is only ACKed again.
+ *      (v) each ACK carries the server's cumulative ACK point and a 
+ *          selective ACK bitmap of the segments received above it. A segment
+ *          still missing after DUP_THRESH segments sent after it have been
+ *          ACKed is a hole and is resent at once instead of on its timer.
+ *      (vi) new segments are paced: they go out at opts->pace_gain times
+ *          the pacing rate of the congestion control algorithm, in bursts
+ *          of at most opts->pace_burst segments, rather than all at once
+ *          when ACKs open the window.
+ *      (vii) segments that go out together (new ones filling the window,
+ *          holes resent on an ACK, those resent on a timeout) are sent
+ *          with one sendmmsg call per opts->batch segments. If opts->gso
+ *          is set and the kernel supports UDP GSO, each run of full size 
+ *          segments in a call goes to the kernel as one buffer that it 
+ *          splits into datagrams.
  *
  *      The file is sent in chunks as payload to a succession of one or 
  *      more data segments. The number of segments required is determined 
- *      by the size of the file.
+ *      by the size of the file and the payload size agreed with the server.
+ *      Each chunk is read from the file into the segment buffer of its 
+ *      window slot when the segment is first sent (or copied from a 
+ *      mapping of the file if opts->use_mmap is set), so the memory used is
+ *      bounded by the window, whatever the size of the file. With 
+ *      opts->use_mmap the payload is not copied at all: each segment is 
+ *      sent as its header followed by the chunk in the mapping, for the 
+ *      first transmission and for every resend. With opts->zerocopy the 
+ *      kernel does not copy it either (MSG_ZEROCOPY) and reports when it is
+ *      done with the pages.
  *
- *      THE SERVER EXPECTS EACH CHUNK OF A FILE TO BE A CORRECTLY TERMINATED
- *      STRING. This function must guarantee this property for the payload
- *      it sends.
+ *      Chunks are sent as they are, any bytes (text or binary). The 
+ *      payload_bytes of a segment is the length of its chunk and the 
+ *      server writes exactly that many bytes.
+ *
+ *      The bytes sent are the range of bytes_to_read bytes of the file at
+ *      opts->range_offset (0 to send the whole file). If opts->tree is set,
+ *      infd is the directory of the tree and the bytes sent are the stream
+ *      of the tree: its manifest and the content of its files. If 
+ *      opts->script is set, infd is the delta script built by make_delta.
+ *
+ *      The bytes are hashed as they are read (xxHash64, in offset order).
+ *      Once the server has them all, a DIGEST_SEG with the digest and the
+ *      byte count is sent and the server replies with its own digest of
+ *      the bytes it wrote (for a delta script, the digest of the file and
+ *      of the file the server rebuilt); the client exits with an error if 
+ *      the two differ or no reply comes after DIGEST_RETRIES tries.
  *      
- *      The main client function does not call send_file_normal if infd is
- *      empty.
+ *      The main client function does not call send_file_with_timeout if infd
+ *      is empty.
  *      
  *      This function has the following side effects:
  *      - information messages printed for the user to follow progress of the
@@ -161,13 +320,118 @@ size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd,
  * bytes_to_read - the number of bytes expected to be read form the file
  *      (initialised to the file size)
  * loss_prob - the probability of the loss or corruption of a segment
+ * opts - transfer options (size of the send window, payload size agreed
+ *      with the server, congestion control algorithm)
  *
  * Return:
  * On success: the number of bytes sent to the server
  * On failure: the function causes exit of the client with an error message
  */
 size_t send_file_with_timeout(int sockfd, struct sockaddr_in* server, int infd, 
-    size_t bytes_to_read, float loss_prob);
+    size_t bytes_to_read, float loss_prob, tfr_opts_t* opts);
+
+/* 
+ * send_file_parallel - send the file represented by the given open file
+ *      descriptor as ranges of opts->range_size bytes (or opts->streams 
+ *      ranges of equal size if it is 0) over opts->streams streams at the 
+ *      same time. Each stream is a thread that takes the next range not 
+ *      sent yet and sends it as a session of its own: from a socket of its
+ *      own, with its own metadata, sequence numbers, send window and 
+ *      congestion control, with send_file_with_timeout (or 
+ *      send_file_normal). The server writes each range at its offset into
+ *      the one output file. A transfer that resumes one cut off sends only
+ *      the ranges in opts->missing, split in the same way.
+ *
+ *      This function has the side effects of the functions it calls for
+ *      each range and closes infd.
+ *
+ * Parameters:
+ * server_addr - the server IP address (e.g. 127.0.0.1)
+ * port - the port the server is listening on
+ * infd - open file descriptor of the client's input file (not empty)
+ * file_size - the size of the file
+ * output_file - the name of the file that the server will create
+ * with_timeout - send ranges with send_file_with_timeout, else with 
+ *      send_file_normal
+ * loss_prob - the probability of the loss or corruption of a segment
+ * opts - transfer options, opts->payload_size is set to the payload size 
+ *      used by the first stream
+ *
+ * Return:
+ * On success: the number of bytes sent to the server
+ * On failure: the function causes exit of the client with an error message
+ */
+size_t send_file_parallel(char* server_addr, int port, int infd, 
+    size_t file_size, char* output_file, bool with_timeout, float loss_prob,
+    tfr_opts_t* opts);
+
+/*
+ * resume_ranges - find the ranges of the file the server does not have on
+ *      disk yet from a transfer of the same version of the file that was
+ *      cut off, to resume the transfer by sending only them.
+ *
+ *      The ranges the journal of the server records on disk are asked for
+ *      with a RESUME_SEG from a socket of its own, sent again if the reply
+ *      does not come. 
+ *
+ *      As a by-product of this function information messages are printed
+ *      about the ranges the server has.
+ *
+ * Parameters:
+ * server_addr - the server IP address (e.g. 127.0.0.1)
+ * port - the port the server is listening on
+ * file_size - the size of the file (not empty)
+ * output_file - the name of the file on the server
+ * opts - transfer options, opts->source is the identity of the version of
+ *      the file
+ * missing - room for the RESUME_RANGES_MAX + 1 ranges still to send, in 
+ *      order
+ *
+ * Return:
+ * The number of ranges still to send (0 if the server has all of the 
+ *      file), or -1 if the server has none of the file on disk or does not
+ *      reply: the file is then sent as it would be without a journal
+ */
+int resume_ranges(char* server_addr, int port, off_t file_size, 
+    char* output_file, tfr_opts_t* opts, journal_range_t* missing);
+
+/*
+ * make_delta - build the delta script of the input file against the copy of
+ *      the file the server has, to send in place of the file (see 
+ *      rft_delta.h).
+ *
+ *      The signatures of the blocks of the server's copy are asked for with
+ *      DELTA_SEGs from a socket of its own, so that late replies do not 
+ *      reach the socket of the transfer, a window of requests at a time. 
+ *      The input file is mapped and scanned for the blocks and the script
+ *      is built in a file in memory, with the digest of the input file to
+ *      compare with the file the server rebuilds.
+ *
+ *      As a by-product of this function information messages are printed
+ *      about the signatures and the script.
+ *
+ * Parameters:
+ * server - the server sockaddr struct (filled out by create_udp_socket)
+ * infd - open file descriptor of the client's input file (not empty)
+ * file_size - the size of the file
+ * output_file - the name of the file on the server
+ * opts - transfer options, opts->payload_size bounds the size of the 
+ *      replies
+ * delta - the script built
+ *
+ * Return:
+ * True if the script was built. False if the server has no copy of the file
+ *      with a full block or does not reply, or if the script could not be
+ *      built: the file is then sent itself
+ */
+bool make_delta(struct sockaddr_in* server, int infd, off_t file_size, 
+    char* output_file, tfr_opts_t* opts, delta_t* delta);
+
+/*
+ * new_session_id - a session id for a transfer, different for each call and
+ *      for clients started at the same time
+ */
+uint32_t new_session_id();
 
 /* 
  * Definition of utility function provided for you
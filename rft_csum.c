@@ -0,0 +1,410 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rft_csum.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HW 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78  // CRC32C polynomial, bit reversed
+#define CRC32C_LONG 8192    // bytes of each of three blocks CRCed at once
+#define CRC32C_SHORT 256    // same for the rest of shorter buffers
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static char* csum_names[CSUM_TYPES] = { "sum", "crc32c", "xxhash" };
+
+/* slicing-by-8 tables of the table driven CRC32C */
+static uint32_t crc32c_table[8][256];
+
+/* tables to shift a CRC32C over CRC32C_LONG and CRC32C_SHORT zero bytes */
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc32c_fn)(uint32_t crc, const void* buf, size_t len);
+static char* crc32c_impl = "table";
+
+/* multiply vec by the 32x32 bit matrix mat over GF(2) */
+static uint32_t gf2_matrix_times(uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++) {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, uint32_t* mat) {
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+ * tables to shift a CRC over len zero bytes (a power of 2): the operator
+ * for one zero bit squared until it is the operator for len bytes, applied
+ * to each byte value of each byte of a CRC
+ */
+static void crc32c_zeros(uint32_t zeros[4][256], size_t len) {
+    uint32_t op[32];
+    uint32_t odd[32];
+
+    odd[0] = CRC32C_POLY;
+
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+
+    /* one zero bit in odd, 2 in op, 4 in odd, then 8 (one byte) in op */
+    gf2_matrix_square(op, odd);
+    gf2_matrix_square(odd, op);
+    gf2_matrix_square(op, odd);
+
+    for (; len > 1; len >>= 1) {
+        gf2_matrix_square(odd, op);
+        memcpy(op, odd, sizeof(op));
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static uint32_t crc32c_shift(uint32_t zeros[4][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+        zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void* buf, size_t len) {
+    const unsigned char* p = buf;
+
+    crc = ~crc;
+
+    for (; len && ((uintptr_t) p & 7); len--)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w;
+
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xff] ^
+            crc32c_table[6][(w >> 8) & 0xff] ^
+            crc32c_table[5][(w >> 16) & 0xff] ^
+            crc32c_table[4][(w >> 24) & 0xff] ^
+            crc32c_table[3][(w >> 32) & 0xff] ^
+            crc32c_table[2][(w >> 40) & 0xff] ^
+            crc32c_table[1][(w >> 48) & 0xff] ^
+            crc32c_table[0][w >> 56];
+    }
+#endif
+
+    for (; len; len--)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef CRC32C_HW
+static inline uint64_t load64(const unsigned char* p) {
+    uint64_t w;
+
+    memcpy(&w, p, sizeof(w));
+
+    return w;
+}
+
+/*
+ * the crc32 instruction has a latency of 3 cycles and a throughput of 1,
+ * three independent CRCs of consecutive blocks keep it busy
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    uint64_t crc0 = ~crc;
+
+    for (; len && ((uintptr_t) p & 7); len--)
+        crc0 = _mm_crc32_u8(crc0, *p++);
+
+    while (len >= 3 * CRC32C_LONG) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const unsigned char* end = p + CRC32C_LONG;
+
+        for (; p < end; p += 8) {
+            crc0 = _mm_crc32_u64(crc0, load64(p));
+            crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_LONG));
+            crc2 = _mm_crc32_u64(crc2, load64(p + 2 * CRC32C_LONG));
+        }
+
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+        p += 2 * CRC32C_LONG;
+        len -= 3 * CRC32C_LONG;
+    }
+
+    while (len >= 3 * CRC32C_SHORT) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const unsigned char* end = p + CRC32C_SHORT;
+
+        for (; p < end; p += 8) {
+            crc0 = _mm_crc32_u64(crc0, load64(p));
+            crc1 = _mm_crc32_u64(crc1, load64(p + CRC32C_SHORT));
+            crc2 = _mm_crc32_u64(crc2, load64(p + 2 * CRC32C_SHORT));
+        }
+
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+        p += 2 * CRC32C_SHORT;
+        len -= 3 * CRC32C_SHORT;
+    }
+
+    for (; len >= 8; len -= 8, p += 8)
+        crc0 = _mm_crc32_u64(crc0, load64(p));
+
+    for (; len; len--)
+        crc0 = _mm_crc32_u8(crc0, *p++);
+
+    return ~(uint32_t) crc0;
+}
+#endif
+
+/* build the tables and pick the fastest implementation, once */
+static void crc32c_init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32c_table[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++)
+            crc32c_table[k][n] = (crc32c_table[k - 1][n] >> 8) ^
+                crc32c_table[0][crc32c_table[k - 1][n] & 0xff];
+    }
+
+    crc32c_fn = crc32c_sw;
+
+#ifdef CRC32C_HW
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_zeros(crc32c_long, CRC32C_LONG);
+        crc32c_zeros(crc32c_short, CRC32C_SHORT);
+        crc32c_fn = crc32c_hw;
+        crc32c_impl = "SSE4.2";
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return crc32c_fn(crc, buf, len);
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+
+    return acc * XXH_P1 + XXH_P4;
+}
+
+/* hash the 32 byte stripes of len bytes at p into the lanes v */
+static const unsigned char* xxh64_stripes(uint64_t v[4], 
+    const unsigned char* p, size_t len) {
+    const unsigned char* end = p + len;
+    uint64_t w[4];
+
+    for (; end - p >= 32; p += 32) {
+        memcpy(w, p, sizeof(w));
+        v[0] = xxh64_round(v[0], w[0]);
+        v[1] = xxh64_round(v[1], w[1]);
+        v[2] = xxh64_round(v[2], w[2]);
+        v[3] = xxh64_round(v[3], w[3]);
+    }
+
+    return p;
+}
+
+static void xxh64_lanes(uint64_t v[4], uint64_t seed) {
+    v[0] = seed + XXH_P1 + XXH_P2;
+    v[1] = seed + XXH_P2;
+    v[2] = seed;
+    v[3] = seed - XXH_P1;
+}
+
+static uint64_t xxh64_converge(uint64_t v[4]) {
+    uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + 
+        rotl64(v[3], 18);
+
+    for (int i = 0; i < 4; i++)
+        h = xxh64_merge(h, v[i]);
+
+    return h;
+}
+
+/* hash the last bytes (less than a stripe) into h and mix it */
+static uint64_t xxh64_finish(uint64_t h, const unsigned char* p, 
+    const unsigned char* end) {
+    for (; end - p >= 8; p += 8) {
+        uint64_t k;
+
+        memcpy(&k, p, sizeof(k));
+        h ^= xxh64_round(0, k);
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+
+    if (end - p >= 4) {
+        uint32_t k;
+
+        memcpy(&k, p, sizeof(k));
+        h ^= k * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+
+    /* avalanche */
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+uint64_t xxh64(const void* buf, size_t len, uint64_t seed) {
+    const unsigned char* p = buf;
+    uint64_t h;
+
+    /* four lanes over 32 byte stripes */
+    if (len >= 32) {
+        uint64_t v[4];
+
+        xxh64_lanes(v, seed);
+        p = xxh64_stripes(v, p, len);
+        h = xxh64_converge(v);
+    } else {
+        h = seed + XXH_P5;
+    }
+
+    return xxh64_finish(h + len, p, (const unsigned char*) buf + len);
+}
+
+void xxh64_init(xxh64_state_t* st, uint64_t seed) {
+    memset(st, 0, sizeof(xxh64_state_t));
+    st->seed = seed;
+    xxh64_lanes(st->v, seed);
+}
+
+void xxh64_update(xxh64_state_t* st, const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    const unsigned char* end = p + len;
+
+    st->total += len;
+
+    /* complete the stripe started by the last update */
+    if (st->buf_len) {
+        size_t n = 32 - st->buf_len < len ? 32 - st->buf_len : len;
+
+        memcpy(st->buf + st->buf_len, p, n);
+        st->buf_len += n;
+        p += n;
+
+        if (st->buf_len < 32)
+            return;
+
+        xxh64_stripes(st->v, st->buf, 32);
+        st->buf_len = 0;
+    }
+
+    p = xxh64_stripes(st->v, p, end - p);
+    memcpy(st->buf, p, end - p);
+    st->buf_len = end - p;
+}
+
+uint64_t xxh64_digest(xxh64_state_t* st) {
+    uint64_t h = st->total >= 32 ? xxh64_converge(st->v) : 
+        st->seed + XXH_P5;
+
+    return xxh64_finish(h + st->total, st->buf, st->buf + st->buf_len);
+}
+
+int csum_find(char* name) {
+    for (int i = 0; i < CSUM_TYPES; i++) {
+        if (!strcmp(csum_names[i], name))
+            return i;
+    }
+
+    return -1;
+}
+
+char* csum_name(int type) {
+    return type >= 0 && type < CSUM_TYPES ? csum_names[type] : NULL;
+}
+
+char* csum_impl(int type) {
+    if (type == CSUM_CRC32C) {
+        pthread_once(&crc32c_once, crc32c_init);
+        return crc32c_impl;
+    }
+
+    return "portable";
+}
+
+int seg_checksum(int type, segment_t* seg, char* payload, bool is_corrupted) {
+    segment_t hdr;
+    uint32_t cs;
+
+    if (type != CSUM_CRC32C && type != CSUM_XXHASH)
+        return checksum(payload, seg->payload_bytes, is_corrupted);
+
+    /* the header as sent, without the checksum */
+    memcpy(&hdr, seg, sizeof(segment_t));
+    hdr.checksum = 0;
+
+    if (type == CSUM_CRC32C) {
+        cs = crc32c(0, &hdr, sizeof(segment_t));
+        cs = crc32c(cs, payload, seg->payload_bytes);
+    } else {
+        uint64_t h = xxh64(payload, seg->payload_bytes,
+            xxh64(&hdr, sizeof(segment_t), 0));
+
+        cs = (uint32_t) (h ^ (h >> 32));
+    }
+
+    /* any other value is wrong */
+    if (is_corrupted)
+        cs ^= (uint32_t) rand() | 1;
+
+    return (int) cs;
+}
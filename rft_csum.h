@@ -0,0 +1,99 @@
+#ifndef _RFT_CSUM_H
+#define _RFT_CSUM_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "rft_util.h"
+
+/*
+ * Integrity checks of data segments.
+ *
+ * The client proposes a checksum algorithm in the metadata and the server
+ * agrees to it (or to the byte sum if it does not know it). Except for the
+ * byte sum, which only covers the payload, the checksum covers the header
+ * of the segment (with the checksum field 0) and the payload, so a segment
+ * whose sequence number, offset or length is damaged is caught too.
+ *
+ * CRC32C (Castagnoli) is computed with the SSE4.2 crc32 instruction where
+ * the CPU has it, on three interleaved blocks at a time so that the latency
+ * of the instruction is hidden, the CRCs of the blocks are combined with
+ * tables. Elsewhere it is computed with tables, 8 bytes at a time. xxHash64
+ * is a fast hash without hardware support, its 64 bits are folded to 32.
+ *
+ * The whole of a transfer is checked end to end with a digest: xxHash64 of
+ * all bytes sent, in offset order, computed as the bytes are read by the
+ * client and as they are written by the server, with xxh64_update.
+ */
+
+/* checksum algorithms, the values are sent in the metadata */
+typedef enum {
+    CSUM_SUM = 0,           // sum of the payload bytes
+    CSUM_CRC32C,            // CRC32C of header and payload
+    CSUM_XXHASH,            // xxHash64 of header and payload
+    CSUM_TYPES
+} csum_type;
+
+/*
+ * csum_find - the checksum algorithm with the given name: "sum", "crc32c"
+ *      or "xxhash"
+ *
+ * Return:
+ * The algorithm or -1 if there is no algorithm with the name
+ */
+int csum_find(char* name);
+
+/*
+ * csum_name - the name of a checksum algorithm, NULL if there is none
+ */
+char* csum_name(int type);
+
+/*
+ * csum_impl - how the algorithm is computed on this machine ("SSE4.2",
+ *      "table", ...)
+ */
+char* csum_impl(int type);
+
+/*
+ * crc32c - update a CRC32C with len bytes of buf, start with crc 0
+ */
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
+/*
+ * xxh64 - xxHash64 of len bytes of buf with the given seed
+ */
+uint64_t xxh64(const void* buf, size_t len, uint64_t seed);
+
+/* state of an xxHash64 computed over a stream of bytes */
+typedef struct xxh64_state {
+    uint64_t v[4];          // the four lanes
+    uint64_t seed;
+    uint64_t total;         // bytes hashed
+    unsigned char buf[32];  // bytes of a stripe not complete yet
+    size_t buf_len;
+} xxh64_state_t;
+
+/*
+ * xxh64_init, xxh64_update, xxh64_digest - start an xxHash64 with the 
+ *      given seed, add len bytes of buf to it and get the xxHash64 of the
+ *      bytes added so far (the same as xxh64 of all of them)
+ */
+void xxh64_init(xxh64_state_t* st, uint64_t seed);
+void xxh64_update(xxh64_state_t* st, const void* buf, size_t len);
+uint64_t xxh64_digest(xxh64_state_t* st);
+
+/*
+ * seg_checksum - checksum of a data segment with the given algorithm
+ *
+ * Parameters:
+ * type - the algorithm
+ * seg - the header of the segment (its checksum field is not covered)
+ * payload - the payload, seg->payload_bytes bytes (need not follow the
+ *      header, segments may be sent from the mapping of a file)
+ * is_corrupted - return a wrong checksum to simulate a network error
+ *
+ * Return:
+ * The checksum to put into the segment's checksum field
+ */
+int seg_checksum(int type, segment_t* seg, char* payload, bool is_corrupted);
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // memfd_create
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rft_delta.h"
+
+#define DELTA_OUT_SIZE (64 * 1024)
+                            // bytes of the script written at once
+#define DELTA_OP_MAX (1u << 30)
+                            // most bytes of the file produced by one op
+
+/* the script being written, through a buffer */
+typedef struct script {
+    delta_t* d;
+    delta_op_t run;         // copy op not written yet, len 0 if none
+    size_t len;             // bytes in buf
+    char buf[DELTA_OUT_SIZE];
+} script_t;
+
+int delta_block_size(off_t size) {
+    off_t b = DELTA_BLOCK_MIN & ~7;
+
+    /* the square root, a multiple of 8 bytes */
+    while (b < DELTA_BLOCK_MAX && (b + 8) * (b + 8) <= size)
+        b += 8;
+
+    return b < DELTA_BLOCK_MIN ? DELTA_BLOCK_MIN : (int) b;
+}
+
+/* the parts of the rolling checksum of len bytes of buf */
+static void weak_sums(const unsigned char* buf, size_t len, uint32_t* a,
+    uint32_t* b) {
+    *a = *b = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        *a += buf[i];
+        *b += (uint32_t) (len - i) * buf[i];
+    }
+}
+
+static uint32_t weak_sum(uint32_t a, uint32_t b) {
+    return (a & 0xffff) | b << 16;
+}
+
+bool delta_sign(int fd, int block_size, int first, int count,
+    delta_sig_t* sigs) {
+    unsigned char* buf = malloc(block_size);
+
+    if (!buf)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t a, b;
+
+        if (pread(fd, buf, block_size, (off_t) (first + i) * block_size) !=
+                block_size) {
+            free(buf);
+            return false;
+        }
+
+        weak_sums(buf, block_size, &a, &b);
+        sigs[i].weak = weak_sum(a, b);
+        sigs[i].strong = xxh64(buf, block_size, 0);
+    }
+
+    free(buf);
+
+    return true;
+}
+
+static bool script_write(script_t* s, const void* data, size_t len) {
+    const char* p = data;
+
+    s->d->bytes += len;
+
+    while (len) {
+        size_t n = DELTA_OUT_SIZE - s->len < len ? DELTA_OUT_SIZE - s->len :
+            len;
+
+        memcpy(s->buf + s->len, p, n);
+        s->len += n;
+        p += n;
+        len -= n;
+
+        if (s->len == DELTA_OUT_SIZE) {
+            if (write(s->d->fd, s->buf, s->len) != (ssize_t) s->len)
+                return false;
+
+            s->len = 0;
+        }
+    }
+
+    return true;
+}
+
+/* write the run of copied blocks, if any */
+static bool script_run(script_t* s) {
+    if (!s->run.len)
+        return true;
+
+    bool ok = script_write(s, &s->run, sizeof(delta_op_t));
+
+    s->d->ops++;
+    s->d->matched += s->run.len;
+    s->run.len = 0;
+
+    return ok;
+}
+
+/* add a block of the basis to the run of copied blocks */
+static bool script_copy(script_t* s, int block, int block_size) {
+    if (s->run.len && s->run.block + (int) (s->run.len / block_size) ==
+            block && s->run.len + block_size <= DELTA_OP_MAX) {
+        s->run.len += block_size;
+        return true;
+    }
+
+    if (!script_run(s))
+        return false;
+
+    s->run.block = block;
+    s->run.len = block_size;
+
+    return true;
+}
+
+static bool script_literal(script_t* s, const unsigned char* data,
+    size_t len) {
+    if (!script_run(s))
+        return false;
+
+    while (len) {
+        delta_op_t op = { .block = DELTA_LITERAL,
+            .len = len < DELTA_OP_MAX ? len : DELTA_OP_MAX };
+
+        if (!script_write(s, &op, sizeof(delta_op_t)) ||
+                !script_write(s, data, op.len))
+            return false;
+
+        s->d->ops++;
+        s->d->literal += op.len;
+        data += op.len;
+        len -= op.len;
+    }
+
+    return true;
+}
+
+static unsigned sig_hash(uint32_t weak, unsigned mask) {
+    return (weak * 2654435761u >> 7) & mask;
+}
+
+/*
+ * find_block - a block of the basis with the signature of the block_size
+ *      bytes at window, the block after the last one copied first. -1 if
+ *      there is none
+ */
+static int find_block(const delta_sig_t* sigs, const int* head,
+    const int* next, unsigned mask, uint32_t weak, const unsigned char* window,
+    int block_size, int expect, int count) {
+    uint64_t strong = 0;
+    bool hashed = false;
+
+    if (expect >= 0 && expect < count && sigs[expect].weak == weak) {
+        strong = xxh64(window, block_size, 0);
+        hashed = true;
+
+        if (sigs[expect].strong == strong)
+            return expect;
+    }
+
+    for (int j = head[sig_hash(weak, mask)]; j >= 0; j = next[j]) {
+        if (sigs[j].weak != weak)
+            continue;
+
+        if (!hashed) {
+            strong = xxh64(window, block_size, 0);
+            hashed = true;
+        }
+
+        if (sigs[j].strong == strong)
+            return j;
+    }
+
+    return -1;
+}
+
+bool delta_encode(delta_t* d, const unsigned char* file, size_t size,
+    const delta_sig_t* sigs, int count, int block_size) {
+    size_t buckets = 1;
+
+    while (buckets < 2 * (size_t) count)
+        buckets <<= 1;
+
+    script_t* s = malloc(sizeof(script_t));
+    int* head = malloc(buckets * sizeof(int));
+    int* next = malloc((count ? count : 1) * sizeof(int));
+
+    memset(d, 0, sizeof(delta_t));
+    d->block_size = block_size;
+    d->fd = memfd_create("rft-delta", 0);
+
+    if (!s || !head || !next || d->fd < 0) {
+        if (d->fd >= 0)
+            close(d->fd);
+
+        free(s);
+        free(head);
+        free(next);
+        errno = ENOMEM;
+        return false;
+    }
+
+    s->d = d;
+    s->run.len = 0;
+    s->len = 0;
+    memset(head, 0xff, buckets * sizeof(int));
+
+    /* chains of the blocks by weak checksum, in the order of the basis */
+    for (int j = count - 1; j >= 0; j--) {
+        unsigned h = sig_hash(sigs[j].weak, buckets - 1);
+
+        next[j] = head[h];
+        head[h] = j;
+    }
+
+    xxh64_init(&d->digest, 0);
+    xxh64_update(&d->digest, file, size);
+
+    size_t bs = block_size;
+    size_t i = 0;           // start of the window
+    size_t lit = 0;         // first byte not in the script yet
+    uint32_t a = 0, b = 0;
+    bool ok = true;
+
+    if (count && size >= bs)
+        weak_sums(file, bs, &a, &b);
+
+    while (ok && count && i + bs <= size) {
+        int expect = s->run.len ? s->run.block + (int) (s->run.len / bs) : -1;
+        int j = find_block(sigs, head, next, buckets - 1, weak_sum(a, b),
+            file + i, block_size, expect, count);
+
+        if (j >= 0) {
+            ok = (lit == i || script_literal(s, file + lit, i - lit)) &&
+                script_copy(s, j, block_size);
+            i += bs;
+            lit = i;
+
+            if (i + bs <= size)
+                weak_sums(file + i, bs, &a, &b);
+
+            continue;
+        }
+
+        /* roll the window on by a byte */
+        if (i + bs < size) {
+            a += file[i + bs] - file[i];
+            b += a - (uint32_t) bs * file[i];
+        }
+
+        i++;
+    }
+
+    ok = ok && (lit == size || script_literal(s, file + lit, size - lit)) &&
+        script_run(s) && (!s->len ||
+        write(d->fd, s->buf, s->len) == (ssize_t) s->len);
+
+    free(s);
+    free(head);
+    free(next);
+
+    if (!ok || lseek(d->fd, 0, SEEK_SET) < 0) {
+        close(d->fd);
+        return false;
+    }
+
+    return true;
+}
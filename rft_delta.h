@@ -0,0 +1,124 @@
+#ifndef _RFT_DELTA_H
+#define _RFT_DELTA_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "rft_util.h"
+#include "rft_csum.h"
+
+#define DELTA_BLOCK_MIN 700 // fewest bytes per block of the signatures
+#define DELTA_BLOCK_MAX (128 * 1024)
+                            // most bytes per block of the signatures
+#define DELTA_LITERAL -1    // block of an op whose bytes follow it
+#define DELTA_SUFFIX ".rft-delta"
+                            // added to the name of the file the server
+                            // rebuilds a file in, until it is complete
+
+/*
+ * Delta transfer of a file against the copy the server already has.
+ *
+ * In the manner of rsync: the server splits its copy of the file (the
+ * basis) into blocks and sends the client a signature of each full block, a
+ * weak checksum that rolls and an xxHash64. The client slides a window of a
+ * block over its file, rolling the weak checksum on by a byte at a time,
+ * and looks the checksum up in a hash table of the signatures: where the
+ * xxHash64 of the window matches too, the window is a block the server has.
+ * The client then sends a delta script in place of the file, a run of ops,
+ * each a delta_op_t: a copy of len bytes of the basis from the start of a
+ * block (a run of consecutive blocks is one op) or len literal bytes that
+ * follow the op. The server rebuilds the file by applying the ops in order.
+ * A file with a few changed blocks costs its signatures and a script of a
+ * few ops and the changed blocks.
+ *
+ * The signatures are exchanged before the session of the transfer starts,
+ * so that the size of the script is known when the metadata is sent: the
+ * client sends DELTA_SEGs with a delta_req_t and the server replies with a
+ * delta_sigs_t and the signatures of the blocks asked for, keeping no
+ * state. The script is sent like the content of a file. The digest compared
+ * at the end of the transfer is of the file rebuilt, which also catches a
+ * block matched wrongly: the file is rebuilt next to the basis and only
+ * moved over it once the digests match.
+ */
+
+/* signature of a block of the basis */
+typedef struct delta_sig {
+    uint64_t strong;        // xxHash64 of the block
+    uint32_t weak;          // rolling checksum of the block
+} delta_sig_t;
+
+/* request for the signatures of blocks of the server's copy of a file */
+typedef struct delta_req {
+    char name[FILE_NAME_SIZE];  // name of the file on the server
+    int first;              // index of the first block
+    int max;                // most signatures to reply with
+} delta_req_t;
+
+/* reply to a delta_req_t, followed by count signatures */
+typedef struct delta_sigs {
+    off_t basis_bytes;      // bytes of the server's copy, -1 if there is
+                            // none
+    int block_size;         // bytes per block
+    int first;              // index of the first block
+    int count;              // signatures that follow
+} delta_sigs_t;
+
+/* op of a delta script, followed by len bytes if it is literal */
+typedef struct delta_op {
+    int32_t block;          // first block of the basis to copy from or
+                            // DELTA_LITERAL
+    uint32_t len;           // bytes of the file the op produces
+} delta_op_t;
+
+/* a delta script built by the client */
+typedef struct delta {
+    int fd;                 // the script (a file in memory)
+    off_t bytes;            // bytes of the script
+    int block_size;         // bytes per block of the signatures
+    off_t matched;          // bytes of the file copied from the basis
+    off_t literal;          // bytes of the file sent as literals
+    long ops;               // ops in the script
+    xxh64_state_t digest;   // digest of the file
+} delta_t;
+
+/* state of the server applying a script, which arrives in pieces */
+typedef struct delta_apply {
+    int basis_fd;           // the server's copy of the file, -1 if none
+    off_t basis_bytes;      // bytes of the basis
+    delta_op_t op;          // the op being applied
+    size_t have;            // bytes of the op received (up to its size)
+    size_t left;            // literal bytes of the op still to come
+    off_t out;              // bytes of the file rebuilt
+    off_t copied;           // bytes of the file copied from the basis
+    bool failed;            // an op is not valid for the basis
+    bool pending;           // the file rebuilt is neither moved over the
+                            // basis nor removed yet
+} delta_apply_t;
+
+/*
+ * delta_block_size - bytes per block of the signatures of a basis of size
+ *      bytes, about its square root (DELTA_BLOCK_MIN to DELTA_BLOCK_MAX)
+ */
+int delta_block_size(off_t size);
+
+/*
+ * delta_sign - the signatures of count blocks of block_size bytes of the
+ *      file fd from block first on
+ *
+ * Return:
+ * False if the blocks could not be read
+ */
+bool delta_sign(int fd, int block_size, int first, int count,
+    delta_sig_t* sigs);
+
+/*
+ * delta_encode - build the delta script of size bytes of file against the
+ *      count signatures of the basis (blocks of block_size bytes) in a file
+ *      in memory, and the digest of the file
+ *
+ * Return:
+ * False if the script could not be written, errno is set
+ */
+bool delta_encode(delta_t* d, const unsigned char* file, size_t size,
+    const delta_sig_t* sigs, int count, int block_size);
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rft_util.h"
+#include "rft_fec.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void fec_xor(void* dst, const void* src, size_t len) {
+    unsigned char* d = dst;
+    const unsigned char* s = src;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) (d + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*) (d + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*) (d + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i*) (d + i + 48));
+
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*) (s + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*) (s + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i*) (s + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i*) (s + i + 48)));
+        _mm_storeu_si128((__m128i*) (d + i), a0);
+        _mm_storeu_si128((__m128i*) (d + i + 16), a1);
+        _mm_storeu_si128((__m128i*) (d + i + 32), a2);
+        _mm_storeu_si128((__m128i*) (d + i + 48), a3);
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+
+        memcpy(&a, d + i, 8);
+        memcpy(&b, s + i, 8);
+        a ^= b;
+        memcpy(d + i, &a, 8);
+    }
+
+    for (; i < len; i++)
+        d[i] ^= s[i];
+}
+
+int fec_block_size(double loss) {
+    /* a block and its parity see half a loss on average */
+    if (loss * 2 * FEC_K_MAX <= 1)
+        return FEC_K_MAX;
+
+    int k = (int) (1 / (2 * loss));
+
+    return k < FEC_K_MIN ? FEC_K_MIN : k;
+}
+
+fec_block_t* fec_block(fec_block_t* blocks, int first, size_t size) {
+    fec_block_t* b = &blocks[first % WINDOW_MAX];
+
+    if (b->xor && b->first == first)
+        return b;
+
+    fec_drop(b);
+    b->xor = calloc(1, size);
+
+    if (!b->xor)
+        return NULL;
+
+    b->first = first;
+    b->count = 0;
+    b->have = 0;
+
+    return b;
+}
+
+void fec_drop(fec_block_t* b) {
+    free(b->xor);
+    b->xor = NULL;
+}
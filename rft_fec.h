@@ -0,0 +1,74 @@
+#ifndef _RFT_FEC_H
+#define _RFT_FEC_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define FEC_K_MIN 2         // fewest data segments per parity segment
+#define FEC_K_MAX 32        // most data segments per parity segment
+#define FEC_AUTO -1         // block size adapted to the loss rate
+
+/*
+ * Forward error correction of data segments.
+ *
+ * The client follows each block of k consecutive data segments with a
+ * parity segment (FEC_SEG), the XOR of their payloads (a shorter last
+ * payload padded with zeros). The server XORs the payloads of a block it
+ * receives with the parity, so when exactly one segment of the block is
+ * missing what remains is its payload: the segment is recovered without the
+ * round trip of a resend. All segments of a block but the last segment of
+ * the transfer are full, so the offset and length of the missing one follow
+ * from its sq.
+ *
+ * Each data segment carries the sq of the first segment of its block in its
+ * ack field. A parity segment has the sq of the first segment of its block,
+ * the number of segments in the block in its ack field, the offset of the
+ * first segment and, as payload_bytes, the length of the longest payload.
+ *
+ * With FEC_AUTO the client picks k for each block from the loss rate it
+ * sees (segments resent and segments the server reports recovered), about
+ * one loss per two blocks. A block with more than one loss still needs
+ * resends.
+ */
+
+/* a block of segments the server XORs together */
+typedef struct fec_block {
+    int first;              // sq of the first segment of the block
+    int count;              // segments in the block, 0 until its parity
+                            // arrives
+    int have;               // data segments XORed in
+    off_t offset;           // offset of the first segment (from the parity)
+    size_t len;             // bytes of a full payload (from the parity)
+    char* xor;              // XOR of the payloads, NULL if the block is
+                            // not in use
+} fec_block_t;
+
+/*
+ * fec_xor - XOR len bytes of src into dst, 16 bytes at a time with SSE2
+ *      where the CPU has it
+ */
+void fec_xor(void* dst, const void* src, size_t len);
+
+/*
+ * fec_block_size - data segments per parity segment for the given loss
+ *      rate (0.0 to 1.0), FEC_K_MIN to FEC_K_MAX
+ */
+int fec_block_size(double loss);
+
+/*
+ * fec_block - the block of blocks (WINDOW_MAX of them, indexed by the sq
+ *      of their first segment) that starts at sq first, a new block with
+ *      room for size bytes of payload if there is none. A block in its
+ *      place that starts elsewhere is dropped
+ *
+ * Return:
+ * The block or NULL if it could not be allocated
+ */
+fec_block_t* fec_block(fec_block_t* blocks, int first, size_t size);
+
+/*
+ * fec_drop - free the payload of a block, it is no longer in use
+ */
+void fec_drop(fec_block_t* b);
+
+#endif
@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rft_journal.h"
+#include "rft_csum.h"
+
+#define JOURNAL_READ 256    // records read from a journal at once
+
+/* the name of the journal of the output file name */
+static void journal_path(const char* name, char* path, size_t size) {
+    snprintf(path, size, "%s%s", name, JOURNAL_SUFFIX);
+}
+
+static uint64_t rec_check(const journal_rec_t* rec) {
+    return xxh64(rec, offsetof(journal_rec_t, check), 0);
+}
+
+static int range_cmp(const void* a, const void* b) {
+    off_t x = ((const journal_range_t*) a)->start;
+    off_t y = ((const journal_range_t*) b)->start;
+
+    return x < y ? -1 : x > y;
+}
+
+int journal_open(const char* name, bool fresh) {
+    char path[FILE_NAME_SIZE + sizeof(JOURNAL_SUFFIX)];
+
+    journal_path(name, path, sizeof(path));
+
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | (fresh ? O_TRUNC : 0),
+        0644);
+}
+
+bool journal_append(int fd, uint64_t source, off_t size, off_t start,
+    off_t end) {
+    journal_rec_t rec;
+
+    memset(&rec, 0, sizeof(journal_rec_t));
+    rec.source = source;
+    rec.size = size;
+    rec.range.start = start;
+    rec.range.end = end;
+    rec.check = rec_check(&rec);
+
+    /* one write, so records of sessions sharing the journal do not mix */
+    return write(fd, &rec, sizeof(journal_rec_t)) == sizeof(journal_rec_t) &&
+        !fdatasync(fd);
+}
+
+int journal_ranges(const char* name, uint64_t source, off_t size,
+    journal_range_t* ranges, int max) {
+    char path[FILE_NAME_SIZE + sizeof(JOURNAL_SUFFIX)];
+    journal_rec_t recs[JOURNAL_READ];
+    journal_range_t* all = NULL;
+    size_t count = 0;
+    size_t room = 0;
+    ssize_t bytes;
+
+    journal_path(name, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+
+    /* the records of the version, a torn one at the end is cut short */
+    while ((bytes = read(fd, recs, sizeof(recs))) >=
+            (ssize_t) sizeof(journal_rec_t)) {
+        for (size_t i = 0; i < bytes / sizeof(journal_rec_t); i++) {
+            journal_rec_t* rec = &recs[i];
+
+            if (rec->check != rec_check(rec) || rec->source != source ||
+                    rec->size != size || rec->range.start < 0 ||
+                    rec->range.start >= rec->range.end ||
+                    rec->range.end > size)
+                continue;
+
+            /* out of memory, the ranges so far are all that count as durable */
+            if (count == room) {
+                size_t more = room ? room * 2 : JOURNAL_READ;
+                journal_range_t* grown = realloc(all,
+                    more * sizeof(journal_range_t));
+
+                if (!grown)
+                    break;
+
+                all = grown;
+                room = more;
+            }
+
+            all[count++] = rec->range;
+        }
+
+        /* a read that ends in a record cut short is the end of the journal */
+        if (bytes % sizeof(journal_rec_t))
+            break;
+    }
+
+    close(fd);
+
+    /* merge the ranges that overlap or touch */
+    if (count)
+        qsort(all, count, sizeof(journal_range_t), range_cmp);
+
+    int n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (n && all[i].start <= ranges[n - 1].end) {
+            if (all[i].end > ranges[n - 1].end)
+                ranges[n - 1].end = all[i].end;
+        } else if (n < max) {
+            ranges[n++] = all[i];
+        } else {
+            break;
+        }
+    }
+
+    free(all);
+
+    return n;
+}
+
+void journal_remove(const char* name) {
+    char path[FILE_NAME_SIZE + sizeof(JOURNAL_SUFFIX)];
+
+    journal_path(name, path, sizeof(path));
+    unlink(path);
+}
@@ -0,0 +1,109 @@
+#ifndef _RFT_JOURNAL_H
+#define _RFT_JOURNAL_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "rft_util.h"
+
+#define JOURNAL_SUFFIX ".rft-journal"
+                            // added to the name of an output file for the
+                            // name of its journal
+#define JOURNAL_BYTES (16 * 1024 * 1024)
+                            // bytes a session receives in sequence before
+                            // the server makes them durable and records
+                            // them in the journal
+#define RESUME_RANGES_MAX 64
+                            // most durable ranges in a reply to a resume
+                            // request
+
+/*
+ * Journal of the progress of the transfers of a file, so that a transfer
+ * cut off (the client or the server stopped, crashed or lost the network)
+ * is resumed where it stopped rather than sent again from the start.
+ *
+ * The server keeps a journal next to each output file whose client asks for
+ * one: a file of journal_rec_t records, each saying that a range of the file
+ * is on disk. A session receiving a range of the file appends a record of
+ * the bytes from the start of its range up to the point it has received in
+ * sequence every JOURNAL_BYTES, once it has waited for their writes and
+ * flushed them to the disk (fdatasync) and flushes the record in turn, so a
+ * record is only ever written for bytes that are durable. Records are
+ * appended (O_APPEND), the sessions of the ranges of a file sent over
+ * parallel streams share the journal, and carry a checksum: a record cut
+ * short or torn by a crash is ignored. The last record of a session is
+ * written when the client's digest of its range matches, the journal is
+ * removed once its records cover the whole file.
+ *
+ * Each record carries the identity of the version of the file sent (chosen
+ * by the client from the size and time of last change of its file) and its
+ * size, so that what is journaled of another version does not count.
+ *
+ * Before the transfer the client sends a RESUME_SEG with a resume_req_t and
+ * the server replies, keeping no state, with the ranges its journal records
+ * for that version of the file, merged (resume_t). The client then sends
+ * the rest of the file as ranges, a session each.
+ */
+
+/* a range of bytes of a file, from start up to end */
+typedef struct journal_range {
+    off_t start;
+    off_t end;
+} journal_range_t;
+
+/* record of the journal of a file */
+typedef struct journal_rec {
+    uint64_t source;        // identity of the version of the file
+    off_t size;             // bytes of the file
+    journal_range_t range;  // range of the file that is durable
+    uint64_t check;         // xxHash64 of the fields above
+} journal_rec_t;
+
+/* request for the ranges of a file the server has durable */
+typedef struct resume_req {
+    char name[FILE_NAME_SIZE];  // name of the file on the server
+    off_t size;             // bytes of the file
+    uint64_t source;        // identity of the version of the file
+} resume_req_t;
+
+/* reply to a resume_req_t */
+typedef struct resume {
+    int count;              // ranges durable, in order and apart
+    journal_range_t ranges[RESUME_RANGES_MAX];
+} resume_t;
+
+/*
+ * journal_open - open the journal of the output file name to append
+ *      records to, empty if fresh is set
+ *
+ * Return:
+ * The journal or -1 if it could not be opened
+ */
+int journal_open(const char* name, bool fresh);
+
+/*
+ * journal_append - append a record of the durable range of size bytes of
+ *      version source of a file to journal fd and flush it to the disk
+ *
+ * Return:
+ * False if the record could not be written
+ */
+bool journal_append(int fd, uint64_t source, off_t size, off_t start,
+    off_t end);
+
+/*
+ * journal_ranges - the ranges the journal of the output file name records
+ *      durable of size bytes of version source of the file, merged and in
+ *      order (at most max)
+ *
+ * Return:
+ * The number of ranges, 0 if there is no journal
+ */
+int journal_ranges(const char* name, uint64_t source, off_t size,
+    journal_range_t* ranges, int max);
+
+/*
+ * journal_remove - remove the journal of the output file name
+ */
+void journal_remove(const char* name);
+
+#endif
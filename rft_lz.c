@@ -0,0 +1,188 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "rft_lz.h"
+
+#define LZ_HASH_BITS 12     // positions in the hash table (log2)
+#define LZ_HASH_SMALL 10    // same for inputs of less than 4KB
+#define LZ_LAST_LITERALS 5  // bytes at the end never in a match
+#define LZ_OFFSET_MAX 65535 // furthest back a match starts
+#define LZ_RUN_MASK 15      // length in a token that has more bytes
+#define LZ_SKIP_SHIFT 6     // misses in a row before a byte is skipped
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static unsigned hash4(uint32_t v, int bits) {
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+/* bytes of 255 and a last byte below it that add up to n */
+static unsigned char* put_len(unsigned char* op, size_t n) {
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+
+    *op++ = (unsigned char) n;
+
+    return op;
+}
+
+/* room for a sequence of lit literals and a match length of mlen */
+static size_t seq_size(size_t lit, size_t mlen) {
+    return 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1;
+}
+
+size_t lz_compress(const void* src, size_t len, void* dst, size_t cap) {
+    const unsigned char* in = src;
+    const unsigned char* ip = in;
+    const unsigned char* anchor = in;       // first byte not in a sequence
+    const unsigned char* end = in + len;
+    const unsigned char* match_end = len > LZ_LAST_LITERALS ?
+        end - LZ_LAST_LITERALS : in;
+    unsigned char* out = dst;
+    unsigned char* op = out;
+    int bits = len < 4096 ? LZ_HASH_SMALL : LZ_HASH_BITS;
+    uint16_t table[1 << LZ_HASH_BITS];      // position of a 4 byte string
+
+    if (len > LZ_INPUT_MAX)
+        return 0;
+
+    memset(table, 0, sizeof(uint16_t) << bits);
+
+    while (ip + LZ_MIN_MATCH <= match_end) {
+        uint32_t v = read32(ip);
+        unsigned h = hash4(v, bits);
+        const unsigned char* ref = in + table[h];
+
+        table[h] = (uint16_t) (ip - in);
+
+        if (ref >= ip || ip - ref > LZ_OFFSET_MAX || read32(ref) != v) {
+            /* step faster through data that does not match */
+            ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        size_t offset = ip - ref;
+        const unsigned char* mp = ip + LZ_MIN_MATCH;
+
+        for (ref += LZ_MIN_MATCH; mp < match_end && *mp == *ref; ref++)
+            mp++;
+
+        size_t lit = ip - anchor;
+        size_t mlen = mp - ip - LZ_MIN_MATCH;
+
+        if (seq_size(lit, mlen) > cap - (op - out))
+            return 0;
+
+        unsigned char* token = op++;
+
+        *token = (unsigned char) ((lit < LZ_RUN_MASK ? lit : LZ_RUN_MASK) << 4 |
+            (mlen < LZ_RUN_MASK ? mlen : LZ_RUN_MASK));
+
+        if (lit >= LZ_RUN_MASK)
+            op = put_len(op, lit - LZ_RUN_MASK);
+
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = (unsigned char) (offset & 0xff);
+        *op++ = (unsigned char) (offset >> 8);
+
+        if (mlen >= LZ_RUN_MASK)
+            op = put_len(op, mlen - LZ_RUN_MASK);
+
+        ip = anchor = mp;
+    }
+
+    /* the rest is the literals of the last sequence */
+    size_t lit = end - anchor;
+
+    if (seq_size(lit, 0) > cap - (op - out))
+        return 0;
+
+    *op++ = (unsigned char) ((lit < LZ_RUN_MASK ? lit : LZ_RUN_MASK) << 4);
+
+    if (lit >= LZ_RUN_MASK)
+        op = put_len(op, lit - LZ_RUN_MASK);
+
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - out;
+}
+
+/* add the bytes of a length that has more bytes, false past the end */
+static bool get_len(const unsigned char** ip, const unsigned char* end,
+    size_t* n) {
+    unsigned char b;
+
+    do {
+        if (*ip >= end)
+            return false;
+
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+
+    return true;
+}
+
+ssize_t lz_decompress(const void* src, size_t len, void* dst, size_t cap) {
+    const unsigned char* ip = src;
+    const unsigned char* end = ip + len;
+    unsigned char* out = dst;
+    unsigned char* op = out;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        size_t mlen = token & LZ_RUN_MASK;
+
+        if (lit == LZ_RUN_MASK && !get_len(&ip, end, &lit))
+            return -1;
+
+        if (lit > (size_t) (end - ip) || lit > cap - (op - out))
+            return -1;
+
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        /* the last sequence has no match */
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+
+        size_t offset = ip[0] | (size_t) ip[1] << 8;
+
+        ip += 2;
+
+        if (mlen == LZ_RUN_MASK && !get_len(&ip, end, &mlen))
+            return -1;
+
+        mlen += LZ_MIN_MATCH;
+
+        if (!offset || offset > (size_t) (op - out) ||
+                mlen > cap - (op - out))
+            return -1;
+
+        const unsigned char* ref = op - offset;
+
+        /* a match may overlap the bytes it produces */
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--)
+                *op++ = *ref++;
+        }
+    }
+
+    return op - out;
+}
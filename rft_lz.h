@@ -0,0 +1,47 @@
+#ifndef _RFT_LZ_H
+#define _RFT_LZ_H
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LZ_INPUT_MAX 65536  // max bytes compressed at once
+
+/*
+ * Compression of the payloads of data segments.
+ *
+ * A fast LZ77 codec in the manner of LZ4: the compressed form is a run of
+ * sequences, each a token byte, literals copied as they are and a match, a
+ * copy of at least LZ_MIN_MATCH bytes from up to 65535 bytes back in the
+ * output. The high 4 bits of the token are the number of literals and the
+ * low 4 bits the length of the match less LZ_MIN_MATCH, 15 meaning that
+ * bytes of 255 and a last byte below it follow to add to it. A match is
+ * its 2 byte offset (little endian) followed by the extra bytes of its
+ * length. The last sequence has no match and ends the input, the length of
+ * the output follows from decompressing it.
+ *
+ * Matches are found with a hash table of the positions of 4 byte strings,
+ * the first candidate only: the codec trades ratio for speed, text still
+ * shrinks a few times.
+ */
+
+#define LZ_MIN_MATCH 4      // shortest match
+
+/*
+ * lz_compress - compress len bytes (at most LZ_INPUT_MAX) of src into dst,
+ *      which has room for cap bytes
+ *
+ * Return:
+ * Bytes of the compressed data, 0 if it does not fit in cap bytes
+ */
+size_t lz_compress(const void* src, size_t len, void* dst, size_t cap);
+
+/*
+ * lz_decompress - decompress len bytes of src into dst, which has room for
+ *      cap bytes
+ *
+ * Return:
+ * Bytes of the decompressed data, -1 if src is not valid compressed data or
+ *      does not fit in cap bytes
+ */
+ssize_t lz_decompress(const void* src, size_t len, void* dst, size_t cap);
+
+#endif
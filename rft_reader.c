@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rft_reader.h"
+
+/* read len bytes at the given offset of the file, fewer only at its end */
+static ssize_t read_at(int fd, char* buf, size_t len, size_t offset) {
+    /* a read may return fewer bytes than asked for, keep reading */
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0)
+            return -1;
+        else if (!n)
+            break;
+
+        done += n;
+    }
+
+    return done;
+}
+
+/*
+ * copy len bytes of the stream of the tree from the given offset: the 
+ * manifest, then the content of the files from the entry at the offset on
+ */
+static ssize_t read_tree(file_reader_t* rd, size_t offset, char* buf,
+    size_t len) {
+    tree_t* tree = rd->tree;
+    size_t done = 0;
+
+    if (offset < tree->manifest_bytes) {
+        done = tree->manifest_bytes - offset < len ? 
+            tree->manifest_bytes - offset : len;
+        memcpy(buf, tree->manifest + offset, done);
+    }
+
+    for (int i = tree_find(tree, offset + done); done < len; i++) {
+        tree_entry_t* e = &tree->entries[i];
+        size_t at = offset + done - e->offset;
+
+        /* directories and files that end before the offset */
+        if (at >= (size_t) e->size)
+            continue;
+
+        size_t n = e->size - at < len - done ? e->size - at : len - done;
+
+        if (rd->cur != i) {
+            if (rd->cur >= 0) {
+                close(tree->entries[rd->cur].fd);
+                tree->entries[rd->cur].fd = -1;
+            }
+
+            rd->cur = -1;
+
+            if (tree_open(tree, i, rd->fd, false) < 0)
+                return -1;
+
+            rd->cur = i;
+        }
+
+        /* short if the file got shorter since the manifest was built */
+        if (read_at(e->fd, buf + done, n, at) != (ssize_t) n)
+            return -1;
+
+        done += n;
+    }
+
+    return done;
+}
+
+void reader_open(file_reader_t* rd, int fd, size_t size, bool use_mmap) {
+    rd->fd = fd;
+    rd->size = size;
+    rd->map = NULL;
+    rd->tree = NULL;
+    rd->cur = -1;
+
+    if (use_mmap && size) {
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            rd->map = map;
+            madvise(map, size, MADV_SEQUENTIAL);
+        }
+    }
+}
+
+ssize_t reader_read(file_reader_t* rd, size_t offset, char* buf, size_t len) {
+    if (offset >= rd->size)
+        return 0;
+
+    if (len > rd->size - offset)
+        len = rd->size - offset;
+
+    if (rd->map) {
+        memcpy(buf, rd->map + offset, len);
+        return len;
+    }
+
+    if (rd->tree)
+        return read_tree(rd, offset, buf, len);
+
+    return read_at(rd->fd, buf, len, offset);
+}
+
+void reader_open_tree(file_reader_t* rd, int dirfd, tree_t* tree) {
+    reader_open(rd, dirfd, tree->manifest_bytes + tree->bytes, false);
+    rd->tree = tree;
+}
+
+char* reader_map(file_reader_t* rd, size_t offset) {
+    return rd->map ? rd->map + offset : NULL;
+}
+
+void reader_close(file_reader_t* rd) {
+    if (rd->map)
+        munmap(rd->map, rd->size);
+
+    rd->map = NULL;
+
+    if (rd->cur >= 0) {
+        close(rd->tree->entries[rd->cur].fd);
+        rd->tree->entries[rd->cur].fd = -1;
+    }
+
+    rd->cur = -1;
+}
@@ -0,0 +1,75 @@
+#ifndef _RFT_READER_H
+#define _RFT_READER_H
+#include <stdbool.h>
+#include <sys/types.h>
+#include "rft_tree.h"
+
+/*
+ * Streaming reader of the client's input file.
+ *
+ * The sender reads each chunk of the file into the buffer of the segment
+ * that carries it when the segment is first sent, so the file is never held
+ * in memory as a whole: the send window's segment buffers are the ring the
+ * file streams through. A chunk is read with as many reads as it takes
+ * (short reads, EINTR). In mmap mode the file is mapped instead and chunks
+ * are copied from the page cache, which saves a system call per chunk for
+ * files that fit in it, or sent straight from the mapping. A directory tree
+ * is read as its stream, the manifest and then the content of its files,
+ * each file opened when the stream gets to it.
+ */
+
+/* reader of an open file */
+typedef struct file_reader {
+    int fd;                 // file descriptor of the file
+    size_t size;            // bytes in the file
+    char* map;              // mapping of the file (mmap mode), else NULL
+    tree_t* tree;           // the tree read (tree mode), else NULL
+    int cur;                // entry of the tree open for reading, else -1
+} file_reader_t;
+
+/*
+ * reader_open - initialise a reader of the given open file, mapping it if
+ *      use_mmap is set. If the file cannot be mapped the reader falls back
+ *      to read mode.
+ *
+ * Parameters:
+ * rd - the reader to initialise
+ * fd - the open file descriptor of the file, still owned by the caller
+ * size - the bytes in the file
+ * use_mmap - map the file rather than read it
+ */
+void reader_open(file_reader_t* rd, int fd, size_t size, bool use_mmap);
+
+/*
+ * reader_open_tree - initialise a reader of the stream of the given tree
+ *      below the open directory dirfd (still owned by the caller). Trees are
+ *      not mapped.
+ */
+void reader_open_tree(file_reader_t* rd, int dirfd, tree_t* tree);
+
+/*
+ * reader_read - copy len bytes of the file from the given offset into buf
+ *
+ * Return:
+ * The number of bytes copied, less than len only if the file ends before
+ *      offset + len, or -1 on a read error
+ */
+ssize_t reader_read(file_reader_t* rd, size_t offset, char* buf, size_t len);
+
+/*
+ * reader_map - the address of the given offset in the mapping of the file,
+ *      for callers that send from it without copying
+ *
+ * Return:
+ * The address or NULL if the reader is not in mmap mode
+ */
+char* reader_map(file_reader_t* rd, size_t offset);
+
+/*
+ * reader_close - release the mapping of the reader, if any, and close the
+ *      file of a tree it has open (the file descriptor it was opened with
+ *      is left open)
+ */
+void reader_close(file_reader_t* rd);
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // recvmmsg, sendmmsg
+#endif
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -7,11 +10,35 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <linux/filter.h>
 #include "rft_util.h"
+#include "rft_writer.h"
+#include "rft_session.h"
+#include "rft_csum.h"
+#include "rft_lz.h"
+#include "rft_journal.h"
+
+#define GRO_BUF_SIZE 65536  // room for a datagram or a coalesced run of them
+#define GRO_CTRL_SIZE CMSG_SPACE(sizeof(int))
+#define THREADS_MAX 64      // max worker threads (shards) of the server
+#define ACK_EVERY_DEFAULT 2 // data segments in sequence per ACK unless set
+                            // with -a
+#define ACK_DELAY_USEC 500  // time an ACK is held back for more segments
+                            // unless set with -d
+#define ACK_DELAY_MAX_USEC 1000
+                            // max ACK delay set with -d, below the min
+                            // retransmission timeout of the client
 
 /*
  * This file contains the main function for the server.
- * Do NOT change anything in this file.
  * 
  * For a usage message for the server type:
  * 
@@ -21,26 +48,375 @@
  *
  * Or start server as:
  *      
- *      rft_server <port>
+ *      rft_server <port> [-m batch] [-o on|off] [-u on|off] [-t threads]
+ *                  [-a every] [-d delay]
+ *
+ * where port is a port for the server to listen on in the range 1025 to 65535,
+ * -m batch optionally sets the max number of segments received and ACKs
+ * sent with one system call (1 to BATCH_MAX, default BATCH_SIZE), -o 
+ * optionally turns UDP receive offload (GRO) on (the default, used where 
+ * the kernel supports it) or off and -u optionally turns asynchronous file
+ * writes through io_uring on (the default, used where the kernel supports 
+ * it) or off (pwrite), -t optionally sets the number of worker threads
+ * (1 to THREADS_MAX, default 1), -a optionally sets the number of data 
+ * segments received in sequence the server ACKs at once (1 to 
+ * ACK_EVERY_MAX, default ACK_EVERY_DEFAULT, the client may ask for fewer) 
+ * and -d optionally sets the time in microseconds an ACK is held back for
+ * more segments (1 to ACK_DELAY_MAX_USEC, default ACK_DELAY_USEC)
+ *
+ * The server receives files from any number of clients at the same time, 
+ * each transfer a session of its own, until it is stopped with SIGINT or
+ * SIGTERM. Each worker thread is a shard of the server with a socket of its
+ * own bound to the port (SO_REUSEPORT) and its own sessions. The kernel 
+ * steers each datagram to the shard of its session id, so all datagrams of
+ * a session go to the same thread and the threads share no state.
+ *
+ * A client may send a directory in one session: the server receives the 
+ * manifest of the tree, creates the directory with the tree below it and
+ * writes the content of the files that follows to them.
  *
- * where port is a port for the server to listen on in the range 1025 to 65535
+ * ACKs are cumulative (with a selective ACK of the segments above the 
+ * cumulative ACK point), so the server does not ACK each data segment: it
+ * ACKs every few segments received in sequence, a segment that is not 
+ * followed by more within the ACK delay and, at once, every segment that 
+ * is out of order, fills a gap or is a duplicate, so that the client 
+ * learns of a loss as soon as it would with an ACK per segment.
+ *
+ * A client may ask the server to keep a journal of the bytes of a file on
+ * disk: a transfer cut off is then resumed by sending only the ranges of
+ * the file the journal does not record.
+ */
+
+/* 
+ * ACKs queued by process_data_msg to be sent with one sendmmsg call once 
+ * the segments received with one recvmmsg call have been processed
+ */
+typedef struct ack_batch {
+    struct mmsghdr* msgs;
+    struct iovec* iov;      // one per message: the ACK segment
+    struct sockaddr_in* addrs;  // one per message: the client to send it to
+    char* acks;             // room for max ACK segments
+    int len;                // ACKs queued
+    int max;                // ACKs sent per call
+    long calls;             // sendmmsg calls made
+    long sent;              // ACKs sent
+} ack_batch_t;
+
+/* a worker thread of the server, serving the sessions of one shard */
+typedef struct worker {
+    pthread_t thread;
+    int shard;                  // index of the worker's socket in the group
+    int shards;                 // number of workers
+    int sockfd;                 // the worker's socket
+    int stop_fd;                // eventfd signalled to stop the workers
+    int batch_size;
+    bool uring;
+    int ack_every;              // max data segments in sequence per ACK
+    int ack_delay;              // time an ACK is held back (usec)
+} worker_t;
+
+/*
+ * state of the server's event loop: the sessions, the writer of their 
+ * output files and the buffers of the segments received and the ACKs to 
+ * send with one system call
+ */
+typedef struct server {
+    int sockfd;
+    int batch_size;             // max datagrams per recvmmsg/sendmmsg call
+    session_table_t sessions;
+    file_writer_t wr;
+    ack_batch_t acks;
+    int ack_every;              // max data segments in sequence per ACK
+    int ack_delay;              // time an ACK is held back (usec)
+    int ack_timer;              // timerfd of the ACKs held back
+    long long ack_armed;        // time the timer was set, 0 if it is not
+    long acked_segs;            // data segments ACKed
+    long delayed_acks;          // ACKs sent once the timer expired
+    char* dgrams;               // room for a batch of datagrams
+    char* ctrl;                 // control messages (GRO segment size)
+    struct mmsghdr* msgs;
+    struct iovec* iov;
+    struct sockaddr_in* addrs;  // sender of each datagram
+    segment_t* aligned;         // copy of a segment that is not aligned
+    segment_t* rebuilt;         // a segment recovered from parity
+    segment_t* inflated;        // a segment with its payload decompressed
+    long recv_calls;            // recvmmsg calls made
+    long recv_dgrams;           // datagrams received
+    long recv_segs;             // segments received
+    long gro_dgrams;            // datagrams coalesced by GRO
+    long completed;             // sessions complete
+    long failed;                // complete sessions whose digest did not
+                                // match the client's
+    long parity;                // parity segments received
+    long recovered;             // segments recovered from parity
+    long inflated_segs;         // compressed segments decompressed
+    size_t packed_bytes;        // bytes of their compressed payloads
+    size_t raw_bytes;           // bytes of their payloads decompressed
+    long long inflate_usec;     // time spent decompressing them
+} server_t;
+
+/*
+ * serve - receive files from clients on the socket of the worker until the
+ * server is stopped: a single epoll loop receives the segments of all 
+ * sessions of the shard, looks up the session of each in the shard's 
+ * session table and drops idle ones
+ */
+static void* serve(void* arg);
+
+/*
+ * open_socket - open a socket bound to the server address, one of a group
+ * of sockets bound to the same port if reuseport is set. gro is cleared if
+ * the kernel does not support UDP GRO
+ */
+static int open_socket(struct sockaddr_in* server, bool* gro, 
+    bool reuseport);
+
+/*
+ * steer_by_session - attach a program to the group of sockets bound to the
+ * port of the given socket that picks the socket of a datagram by the 
+ * session id at its start, returns false if it is not supported
+ */
+static bool steer_by_session(int sockfd, int shards);
+
+/*
+ * handle_segment - pass a segment received from the given address to its
+ * session: metadata opens a session, other segments of unknown sessions 
+ * are dropped
+ */
+static void handle_segment(server_t* srv, struct sockaddr_in* from, 
+    segment_t* seg, size_t bytes, long long now);
+
+/*
+ * open_session - open a session for the metadata segment of a new client:
+ * create the output file and agree to the payload size. Returns NULL if 
+ * the metadata is invalid or the file cannot be created
+ */
+static session_t* open_session(server_t* srv, struct sockaddr_in* from,
+    segment_t* meta_msg, size_t bytes);
+
+/*
+ * finish_session - close the output file (or directory) of a session once 
+ * all of its segments are written, or when it is dropped before that
+ */
+static void finish_session(server_t* srv, session_t* s);
+
+/*
+ * finish_tree - close the files of the tree of a session and the directory
+ * it is created in, once the writes to them are done
+ */
+static void finish_tree(session_t* s);
+
+/*
+ * tree_ready - whether the payload of a data segment of a session can be 
+ * written: the content of the files of a tree is only written once the 
+ * manifest is received (or with the end of the manifest)
+ */
+static bool tree_ready(session_t* s, segment_t* seg);
+
+/*
+ * write_payload - queue the write of the payload of a data segment of a
+ * session to its file, or to the manifest and the files of its tree. 
+ * Returns false if the tree of the session cannot be created or a write to
+ * it failed, the session is then dropped
+ */
+static bool write_payload(server_t* srv, session_t* s, segment_t* seg);
+
+/*
+ * drop_tree - drop a session whose tree cannot be created. Returns false
+ */
+static bool drop_tree(server_t* srv, session_t* s);
+
+/*
+ * drop_session - close the files of a session (the writes to them must be
+ * done) and its journal, the session is left to expire and its segments 
+ * are not ACKed
+ */
+static void drop_session(session_t* s);
+
+/*
+ * sync_writes - wait for the writes in flight and drop the sessions whose
+ * writes failed, so that the files of the others can be closed
  */
+static void sync_writes(server_t* srv);
+
+/*
+ * write_owner - the session that writes to file fd, NULL if there is none
+ */
+static session_t* write_owner(server_t* srv, int fd);
+
+/*
+ * close_files - wait for the writes to the files of the tree of a session
+ * written to the end and close them. Returns false if a write to the tree
+ * failed, the session is then dropped
+ */
+static bool close_files(server_t* srv, session_t* s);
+
+/*
+ * expire_sessions - drop the sessions idle for SESSION_IDLE_USEC, returns
+ * the time in ms until the next one becomes idle (-1 if there is none)
+ */
+static int expire_sessions(server_t* srv, long long now);
+
+/*
+ * send_meta_reply - reply to the client's metadata with the agreed settings
+ */
+static void send_meta_reply(int sockfd, session_t* s);
+
+/*
+ * check_digest - compare the digest of a complete session with the one the
+ * client sent in a digest segment and reply with the server's digest. A 
+ * mismatch fails the transfer
+ */
+static void check_digest(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes);
 
 /* 
- * receive_file - receive a file on the given socket from the given client 
- * with given file metadata (expected size and name to write output to)
+ * process_data_msg - function used by handle_segment to process a single 
+ * data segment of a session, queue the write of its payload to file at the
+ * segment's offset unless it was written before (a duplicate) and queue an
+ * ack to the client; returns indication of whether still in receiving state
+ * (or all segments up to the last segment have been received).
+ */
+static bool process_data_msg(server_t* srv, session_t* s, segment_t* data_msg,
+    size_t bytes);
+
+/*
+ * inflate_seg - decompress the payload of a compressed data segment of a 
+ * session into the server's inflated segment, with the header of the 
+ * segment. Returns the inflated segment or NULL if the session did not 
+ * agree to compression or the payload does not decompress to a payload 
+ * that fits the file
+ */
+static segment_t* inflate_seg(server_t* srv, session_t* s, segment_t* seg);
+
+/*
+ * take_payload - add the payload of a data segment of a session, in 
+ * sequence, to the digest of the session or, if it is part of a delta 
+ * script, apply it. Every JOURNAL_BYTES in sequence are recorded in the 
+ * journal of the file if the session keeps one
+ */
+static void take_payload(server_t* srv, session_t* s, char* data, 
+    size_t len);
+
+/*
+ * apply_delta - apply the next len bytes of the delta script of a session 
+ * to the basis, writing the bytes of the file they produce and adding them
+ * to the digest of the session. A script that does not fit the file or its
+ * basis fails the transfer
+ */
+static void apply_delta(server_t* srv, session_t* s, char* data, size_t len);
+
+/*
+ * copy_basis - write the bytes of the copy op of the delta script of a 
+ * session from the basis at offset from
+ */
+static void copy_basis(server_t* srv, session_t* s, off_t from);
+
+/*
+ * finish_delta - close the basis of the delta of a session, the file 
+ * rebuilt is kept for the digests to be compared, removed now if the 
+ * transfer is not complete
+ */
+static void finish_delta(session_t* s);
+
+/*
+ * finish_rebuild - move the file rebuilt from the delta script of a session
+ * over its basis if the digest of the session matched the client's, remove
+ * it otherwise and leave the basis as it was
+ */
+static void finish_rebuild(session_t* s, bool matched);
+
+/*
+ * send_sigs - reply to a client's request for the signatures of blocks of
+ * the server's copy of a file
+ */
+static void send_sigs(server_t* srv, struct sockaddr_in* from, segment_t* seg,
+    size_t bytes);
+
+/*
+ * journal_progress - make the bytes a session has received in sequence 
+ * durable and record them in the journal of its file, which the session
+ * stops keeping if the record cannot be written
+ */
+static void journal_progress(server_t* srv, session_t* s);
+
+/*
+ * finish_journal - record the range of a session whose digest matched the
+ * client's in the journal of its file and remove the journal once the 
+ * whole file is durable
+ */
+static void finish_journal(session_t* s);
+
+/*
+ * send_resume - reply to a client's request for the ranges of a file the
+ * journal of the server records on disk
+ */
+static void send_resume(server_t* srv, struct sockaddr_in* from, 
+    segment_t* seg, size_t bytes);
+
+/*
+ * receive_data - process a data segment of a session with process_data_msg
+ * and finish the session once all segments are written
  */
-static void receive_file(int sockfd, struct sockaddr_in* client, 
-    metadata_t* file_inf);
+static void receive_data(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes);
+
+/*
+ * fec_data - XOR the payload of a data segment received for the first time
+ * into its block of FEC, a block whose segments are all in is dropped
+ */
+static void fec_data(recv_window_t* rwin, segment_t* seg);
+
+/*
+ * process_parity - check a parity segment of a session and XOR it into its
+ * block, returns true if it is the first parity of a block that still
+ * misses segments
+ */
+static bool process_parity(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes);
+
+/*
+ * recover_segment - rebuild the segment missing from the block of FEC of a
+ * session that starts at sq first from the XOR of its parity and the other
+ * segments, if it is the only one missing, and receive it like any other
+ */
+static void recover_segment(server_t* srv, session_t* s, int first);
+
+/*
+ * queue_ack - queue an ACK of the segments a session has received: the 
+ * cumulative ACK and a selective ACK of those above it, for the last data
+ * segment received
+ */
+static void queue_ack(server_t* srv, session_t* s);
+
+/*
+ * delay_ack - hold the ACK of the data segments a session has received 
+ * back for more segments, setting the ACK timer if it is not set
+ */
+static void delay_ack(server_t* srv, session_t* s);
+
+/*
+ * send_delayed_acks - send the ACKs held back once the ACK timer expires
+ */
+static void send_delayed_acks(server_t* srv);
 
 /* 
- * process_data_msg - function used by receive_file to process a single data
- * segment and send ack to client and write payload to file
- * returns indication of whether still in receiving state (or last segment
- * has been received).
+ * flush_acks - send the ACKs queued in the batch to the client
+ */
+static void flush_acks(int sockfd, ack_batch_t* acks);
+
+/*
+ * enable_gro - let the kernel coalesce datagrams received on the socket
+ * (UDP_GRO), returns false if it is not supported
+ */
+static bool enable_gro(int sockfd);
+
+/*
+ * gro_seg_size - size of the segments in a received datagram of len bytes:
+ * the segment size reported by UDP GRO if the datagram is a coalesced run of
+ * segments, len otherwise
  */
-static bool process_data_msg(int sockfd, struct sockaddr_in* client, 
-    bool* first_seg, segment_t* data_msg, FILE* out_file);
+static size_t gro_seg_size(struct msghdr* hdr, size_t len);
 
 /* 
  * Functions for information and error messages.
@@ -53,223 +429,2072 @@ static void exit_serr(int line, char* msg); // exit server with error message
 int main(int argc,char *argv[]) {
     /* user needs to enter the port number */
     if (argc < 2) {
-        printf("usage: %s <port>\n", argv[0]);
+        printf("usage: %s <port> [-m batch] [-o on|off] [-u on|off]"
+            " [-t threads] [-a every] [-d delay]\n", argv[0]);
         printf("       port is a number between 1025 and 65535\n");
+        printf("       -m sets the segments received per system call\n");
+        printf("          (1 to %d, default %d)\n", BATCH_MAX, BATCH_SIZE);
+        printf("       -o turns UDP receive offload on/off (default on)\n");
+        printf("       -u turns io_uring file writes on/off (default on)\n");
+        printf("       -t sets the number of worker threads\n");
+        printf("          (1 to %d, default 1)\n", THREADS_MAX);
+        printf("       -a sets the data segments in sequence per ACK\n");
+        printf("          (1 to %d, default %d)\n", ACK_EVERY_MAX, 
+            ACK_EVERY_DEFAULT);
+        printf("       -d sets the time an ACK is held back in usec\n");
+        printf("          (1 to %d, default %d)\n", ACK_DELAY_MAX_USEC, 
+            ACK_DELAY_USEC);
         exit(EXIT_FAILURE);
     }
     
     int port = atoi(argv[1]);
+    int batch_size = BATCH_SIZE;
+    bool gro = true;
+    bool uring = true;
+    int threads = 1;
+    int ack_every = ACK_EVERY_DEFAULT;
+    int ack_delay = ACK_DELAY_USEC;
     
     if (port < PORT_MIN || port > PORT_MAX) 
         exit_serr(__LINE__, "Port is outside valid range");
     
-    /* create a socket */
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    
-    if (sockfd == -1)
-        exit_serr(__LINE__, "Failed to open socket"); 
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            errno = EINVAL;
+            exit_serr(__LINE__, "Invalid option");
+        } else if (!strcmp(argv[i], "-m")) {
+            batch_size = atoi(argv[i + 1]);
         
-    print_sep();
-    print_smsg("Socket created");
- 
+            if (batch_size < 1 || batch_size > BATCH_MAX) {
+                errno = EINVAL;
+                exit_serr(__LINE__, "Batch size is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-o") && (!strcmp(argv[i + 1], "on") ||
+                !strcmp(argv[i + 1], "off"))) {
+            gro = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-u") && (!strcmp(argv[i + 1], "on") ||
+                !strcmp(argv[i + 1], "off"))) {
+            uring = !strcmp(argv[i + 1], "on");
+        } else if (!strcmp(argv[i], "-t")) {
+            threads = atoi(argv[i + 1]);
+        
+            if (threads < 1 || threads > THREADS_MAX) {
+                errno = EINVAL;
+                exit_serr(__LINE__, "Number of threads is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-a")) {
+            ack_every = atoi(argv[i + 1]);
+        
+            if (ack_every < 1 || ack_every > ACK_EVERY_MAX) {
+                errno = EINVAL;
+                exit_serr(__LINE__, "Segments per ACK is outside valid range");
+            }
+        } else if (!strcmp(argv[i], "-d")) {
+            ack_delay = atoi(argv[i + 1]);
+        
+            if (ack_delay < 1 || ack_delay > ACK_DELAY_MAX_USEC) {
+                errno = EINVAL;
+                exit_serr(__LINE__, "ACK delay is outside valid range");
+            }
+        } else {
+            errno = EINVAL;
+            exit_serr(__LINE__, "Invalid option");
+        }
+    }
+    
     /* set up address structures */
     struct sockaddr_in server;
-    struct sockaddr_in client;
     socklen_t sock_len = (socklen_t) sizeof(struct sockaddr_in); 
     memset(&server, 0, sock_len);
-    memset(&client, 0, sock_len);
     
     /* Fill in the server address structure */
     server.sin_family = AF_INET;
     server.sin_addr.s_addr = INADDR_ANY;
     server.sin_port = htons(port);  // convert to network byte order
     
-    /* bind/associate the socket with the server address */
-    if(bind(sockfd, (struct sockaddr *) &server, sock_len)) {
-        close(sockfd);
-        exit_serr(__LINE__, "Bind failed");
+    /* 
+     * one socket per worker, all bound to the port: socket i of the group 
+     * is the socket of shard i
+     */
+    worker_t workers[THREADS_MAX];
+    
+    for (int i = 0; i < threads; i++) {
+        workers[i].shard = i;
+        workers[i].shards = threads;
+        workers[i].sockfd = open_socket(&server, &gro, threads > 1);
+        workers[i].batch_size = batch_size;
+        workers[i].uring = uring;
+        workers[i].ack_every = ack_every;
+        workers[i].ack_delay = ack_delay;
     }
     
-    print_smsg("Bind success ... "
-                        "Ready to receive meta data from client"); 
-    print_sep();
     print_sep();
-      
-    metadata_t file_inf;
-    socklen_t addr_len = sock_len;
-    ssize_t bytes = -1;
-
-    //receive from the client    
-    bytes = recvfrom(sockfd, &file_inf, sizeof(metadata_t), 0, 
-                    (struct sockaddr*) &client, &addr_len);
-    if (bytes < 0 ) {
-        close(sockfd);
-        exit_serr(__LINE__, "Reading stream message error");
-    } else if (!bytes) {
-        errno = ENOMSG;
-        exit_serr(__LINE__, "Ending connection - no metadata received");
-    } else {
-        print_smsg("Meta data received successfully");
-        char inf_msg_buf[INF_MSG_SIZE];              
-        snprintf(inf_msg_buf, INF_MSG_SIZE, 
-            "Output file name: %s, expected file size: %ld", file_inf.name, 
-            (long) file_inf.size);
-        print_smsg(inf_msg_buf);
+    print_smsg("Socket created");
+    
+    /* 
+     * the kernel would steer by a hash of the client address and port, 
+     * which keeps the datagrams of a session on one shard too
+     */
+    if (threads > 1 && !steer_by_session(workers[0].sockfd, threads))
+        print_smsg("Steering by session id not supported, steering by "
+            "client address");
+    
+    /* 
+     * each session has its output file open, allow as many open files as
+     * the system lets the server have
+     */
+    struct rlimit nofile;
+    
+    if (!getrlimit(RLIMIT_NOFILE, &nofile) && 
+            nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
     }
     
+    print_smsg("Bind success ... "
+                        "Ready to receive meta data from clients"); 
     print_sep();
     print_sep();
-    print_smsg("Waiting for the file ..."); 
     
-    receive_file(sockfd, &client, &file_inf);
+    /* 
+     * the workers do not take SIGINT and SIGTERM, the main thread waits 
+     * for them and tells the workers to stop
+     */
+    sigset_t stop_sigs;
+    sigemptyset(&stop_sigs);
+    sigaddset(&stop_sigs, SIGINT);
+    sigaddset(&stop_sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_sigs, NULL);
     
-    close(sockfd);
+    int stop_fd = eventfd(0, 0);
     
-    struct stat stat_buf;
-    stat(file_inf.name, &stat_buf);
-
-    char inf_msg_buf[INF_MSG_SIZE];
-    snprintf(inf_msg_buf, INF_MSG_SIZE, "%ld bytes written to file %s",
-        (long) stat_buf.st_size, file_inf.name);
+    if (stop_fd < 0)
+        exit_serr(__LINE__, "Could not create stop event");
+    
+    for (int i = 0; i < threads; i++) {
+        workers[i].stop_fd = stop_fd;
         
-    print_smsg(inf_msg_buf);
-    print_sep();
-    print_sep();
+        if (pthread_create(&workers[i].thread, NULL, serve, &workers[i])) {
+            errno = EAGAIN;
+            exit_serr(__LINE__, "Could not start worker thread");
+        }
+    }
     
+    int sig;
+    uint64_t stop = 1;
+    sigwait(&stop_sigs, &sig);
+    
+    if (write(stop_fd, &stop, sizeof(stop)) != sizeof(stop))
+        exit_serr(__LINE__, "Could not stop worker threads");
+    
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].sockfd);
+    }
+    
+    close(stop_fd);
 
     return EXIT_SUCCESS;
 }
 
-static void receive_file(int sockfd, struct sockaddr_in* client, 
-    metadata_t* file_inf) {
-    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
-    segment_t data_msg;
-
-
-
-    /* Open the output file */
-    FILE* out_file = fopen(file_inf->name, "w");
+static int open_socket(struct sockaddr_in* server, bool* gro, 
+    bool reuseport) {
+    /* create a socket */
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     
-    if (!out_file) 
-        exit_serr(__LINE__, "Could not open output file");
-        
-    // don't wait for empty file
-    if (!file_inf->size) {
-        fclose(out_file);
-        return;
-    }
-                
-    print_sep();
-    print_sep();
+    if (sockfd == -1)
+        exit_serr(__LINE__, "Failed to open socket"); 
     
-    bool receiving = true;
-    bool first_seg = true;
-    size_t seg_size = sizeof(segment_t);
-
-    /* while still receiving segments */
-    while (receiving) {
-        memset(&data_msg, 0, seg_size);
-        ssize_t bytes = recvfrom(sockfd, &data_msg, seg_size, 0,
-                        (struct sockaddr*) client, &addr_len);
-        
-        if (bytes < 0) {
-            fclose(out_file);
-            exit_serr(__LINE__, "Reading stream message error");
-        } else if (!bytes) {
-            print_smsg("Ending connection");
-            receiving = false;
-        } else {
-            receiving = process_data_msg(sockfd, client, &first_seg, &data_msg,                 
-                            out_file);
-        }
-    }
+    int on = 1;
     
-    print_smsg("File copying complete");
+    if (reuseport && 
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+        close(sockfd);
+        exit_serr(__LINE__, "Could not share the port between sockets");
+    }
     
-    print_sep();
+    /* 
+     * a larger receive buffer lets the socket queue a full window of large
+     * segments (best effort, the kernel may cap the size)
+     */
+    int buf_size = SOCK_BUF_SIZE;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
     
-    fclose(out_file);
-}
-
-static bool process_data_msg(int sockfd, struct sockaddr_in* client, 
-    bool* first_seg, segment_t* data_msg, FILE* out_file) {
-    bool receiving = true;
-    char inf_msg_buf[INF_MSG_SIZE];
-    size_t seg_size = sizeof(segment_t);
-
-    if (*first_seg) {
-        /* first segment to be received */
-        print_smsg("File transfer started"); 
-        print_sep();
+    /* 
+     * let the kernel coalesce runs of segments from the client into one
+     * receive (UDP GRO), serve splits them again
+     */
+    if (*gro && !enable_gro(sockfd)) {
+        print_smsg("UDP receive offload not supported, receiving one "
+            "segment per datagram");
+        *gro = false;
     }
-
-    snprintf(inf_msg_buf, INF_MSG_SIZE, 
-        "Received segment with sq: %d, payload bytes: %zu, checksum: %d", 
-        data_msg->sq, data_msg->payload_bytes, data_msg->checksum);
-    print_smsg(inf_msg_buf);
     
-    if (data_msg->payload[PAYLOAD_SIZE - 1]) {
-        print_smsg("Payload not terminated");
-        print_smsg("Did NOT send any ACK");
-        print_sep();
-        return receiving;
+    /* bind/associate the socket with the server address */
+    if (bind(sockfd, (struct sockaddr *) server, sizeof(struct sockaddr_in))) {
+        close(sockfd);
+        exit_serr(__LINE__, "Bind failed");
     }
+    
+    return sockfd;
+}
 
-    snprintf(inf_msg_buf, INF_MSG_SIZE, "Received payload:\n%s",
-        data_msg->payload);
-    print_smsg(inf_msg_buf);
-    print_sep();
+static bool steer_by_session(int sockfd, int shards) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    /* 
+     * the program sees the UDP payload: socket = session id % shards. The 
+     * id is loaded in network byte order, which is just another id
+     */
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, 0 },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, shards },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), 
+        .filter = code };
+    
+    return !setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+        sizeof(prog));
+#else
+    return false;
+#endif
+}
 
-    int cs = checksum(data_msg->payload, false);
+/* lets one shard at a time print its report when the server stops */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static void* serve(void* arg) {
+    worker_t* w = arg;
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+    char inf_msg_buf[INF_MSG_SIZE];
+    int batch_size = w->batch_size;
+    int sockfd = w->sockfd;
+    bool uring = w->uring;
+    server_t srv = { .sockfd = sockfd, .batch_size = batch_size, 
+        .ack_every = w->ack_every, .ack_delay = w->ack_delay };
+    ack_batch_t* acks = &srv.acks;
+    
     /* 
-     * If the calculated checksum is same as that of recieved 
-     * checksum then send corrosponding ack
+     * payloads are written asynchronously so that a slow disk does not 
+     * hold up receiving, with buffers for the largest payload size
      */
-    if (cs == data_msg->checksum) {
-        /* is it the last segment or will we still be receiving*/
-        receiving = !data_msg->last;
-         
-        snprintf(inf_msg_buf, INF_MSG_SIZE, "Calculated checksum %d VALID",
-            cs);
-        print_smsg(inf_msg_buf);
+    if (!writer_open(&srv.wr, PAYLOAD_SIZE_MAX, uring))
+        exit_serr(__LINE__, "Could not allocate file writer");
     
-        /* Prepare the Ack segment */
-        segment_t ack_msg;
-        memset(&ack_msg, 0, seg_size);
-        ack_msg.sq = data_msg->sq;
-        ack_msg.type= ACK_SEG;
+    if (uring && srv.wr.ring_fd < 0)
+        print_smsg("io_uring not supported, writing files with pwrite");
     
-        snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending ACK with sq: %d",
-            ack_msg.sq);
-        print_smsg(inf_msg_buf);
+    /* 
+     * room for a batch of any datagrams or coalesced runs of them and the
+     * ACKs to them
+     */
+    srv.dgrams = malloc((size_t) batch_size * GRO_BUF_SIZE);
+    srv.ctrl = malloc((size_t) batch_size * GRO_CTRL_SIZE);
+    srv.msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    srv.iov = calloc(batch_size, sizeof(struct iovec));
+    srv.addrs = calloc(batch_size, sizeof(struct sockaddr_in));
+    srv.aligned = malloc(DGRAM_SIZE_MAX);
+    srv.rebuilt = malloc(DGRAM_SIZE_MAX);
+    srv.inflated = malloc(sizeof(segment_t) + PAYLOAD_SIZE_MAX);
+    acks->max = batch_size;
+    acks->msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    acks->iov = calloc(batch_size, sizeof(struct iovec));
+    acks->addrs = calloc(batch_size, sizeof(struct sockaddr_in));
+    acks->acks = calloc(batch_size, ACK_SIZE);
     
-        /* Send the Ack segment */
-        ssize_t bytes = sendto(sockfd, &ack_msg, seg_size, 0,
-                    (struct sockaddr*) client, sizeof(struct sockaddr_in));
-                    
-        if (bytes < 0) {
-            print_serr(__LINE__, "Sending stream message error");
-        } else if (!bytes) {
-            print_smsg("Ending connection");
-        } else {
-            /* write the payload of the data segment to output file */
-            fprintf(out_file, "%s", data_msg->payload);
-            printf("        >>>> NETWORK: ACK sent successfully <<<<\n");
-            *first_seg = false;
-        }
-     
-        print_sep();
-        print_sep();
-    } else {
-        snprintf(inf_msg_buf, INF_MSG_SIZE, "Segment checksum %d INVALID",
-            cs);
-        print_smsg(inf_msg_buf);
-        print_smsg("Did NOT send any ACK");
-        print_sep();
-    }    
+    if (!sessions_init(&srv.sessions) || !srv.dgrams || !srv.ctrl || 
+            !srv.msgs || !srv.iov || !srv.addrs || !srv.aligned || 
+            !srv.rebuilt || !srv.inflated || 
+            !acks->msgs || !acks->iov || !acks->addrs || !acks->acks)
+        exit_serr(__LINE__, "Could not allocate receive buffers");
     
-    return receiving;
+    for (int i = 0; i < batch_size; i++) {
+        srv.iov[i].iov_base = srv.dgrams + (size_t) i * GRO_BUF_SIZE;
+        srv.iov[i].iov_len = GRO_BUF_SIZE;
+        srv.msgs[i].msg_hdr.msg_iov = &srv.iov[i];
+        srv.msgs[i].msg_hdr.msg_iovlen = 1;
+        srv.msgs[i].msg_hdr.msg_name = &srv.addrs[i];
+        acks->msgs[i].msg_hdr.msg_name = &acks->addrs[i];
+        acks->msgs[i].msg_hdr.msg_namelen = addr_len;
+        acks->msgs[i].msg_hdr.msg_iov = &acks->iov[i];
+        acks->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    /* 
+     * the event loop waits for the socket, for the ACKs held back, for the
+     * next idle session or for the stop event (which is never read so that
+     * it stops all workers)
+     */
+    int epfd = epoll_create1(0);
+    srv.ack_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sockfd };
+    struct epoll_event stop_ev = { .events = EPOLLIN, .data.fd = w->stop_fd };
+    struct epoll_event timer_ev = { .events = EPOLLIN, 
+        .data.fd = srv.ack_timer };
+    struct epoll_event events[3];
+    bool serving = true;
+    
+    if (epfd < 0 || srv.ack_timer < 0 || 
+            epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) ||
+            epoll_ctl(epfd, EPOLL_CTL_ADD, w->stop_fd, &stop_ev) ||
+            epoll_ctl(epfd, EPOLL_CTL_ADD, srv.ack_timer, &timer_ev))
+        exit_serr(__LINE__, "Could not set up epoll");
+
+    while (serving) {
+        int timeout = expire_sessions(&srv, now_usec());
+        int n = epoll_wait(epfd, events, 3, timeout);
+        bool readable = false;
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0)
+            exit_serr(__LINE__, "Waiting for segments error");
+        
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == w->stop_fd)
+                serving = false;
+            else if (events[i].data.fd == srv.ack_timer)
+                send_delayed_acks(&srv);
+            else
+                readable = true;
+        }
+        
+        if (!serving || !readable)
+            continue;
+        
+        /* take all datagrams queued on the socket, a batch per call */
+        int count = batch_size;
+        
+        while (count == batch_size) {
+            for (int i = 0; i < batch_size; i++) {
+                srv.msgs[i].msg_hdr.msg_namelen = addr_len;
+                srv.msgs[i].msg_hdr.msg_control = srv.ctrl + i * GRO_CTRL_SIZE;
+                srv.msgs[i].msg_hdr.msg_controllen = GRO_CTRL_SIZE;
+            }
+            
+            count = recvmmsg(sockfd, srv.msgs, batch_size, MSG_DONTWAIT, NULL);
+            
+            if (count < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    break;
+                
+                exit_serr(__LINE__, "Reading stream message error");
+            }
+            
+            srv.recv_calls++;
+            srv.recv_dgrams += count;
+            long long now = now_usec();
+            
+            for (int i = 0; i < count; i++) {
+                char* dgram = srv.iov[i].iov_base;
+                size_t len = srv.msgs[i].msg_len;
+                size_t seg_size = gro_seg_size(&srv.msgs[i].msg_hdr, len);
+                
+                if (seg_size < len)
+                    srv.gro_dgrams++;
+                
+                /* split a coalesced run into segments, the last may be short */
+                for (size_t off = 0; off < len; off += seg_size) {
+                    size_t bytes = len - off < seg_size ? len - off : seg_size;
+                    segment_t* seg = (segment_t*) (dgram + off);
+                    
+                    /* segments after the first may not be aligned */
+                    if (off % sizeof(long long)) {
+                        memcpy(srv.aligned, dgram + off, bytes);
+                        seg = srv.aligned;
+                    }
+                    
+                    srv.recv_segs++;
+                    
+                    if (acks->len == acks->max)
+                        flush_acks(sockfd, acks);
+                    
+                    if (bytes >= sizeof(segment_t))
+                        handle_segment(&srv, &srv.addrs[i], seg, bytes, now);
+                }
+            }
+            
+            /* one system call submits the writes of the batch */
+            if (!writer_submit(&srv.wr))
+                exit_serr(__LINE__, "Writing output file error");
+            
+            /* a failed write drops the session of its file, not the server */
+            if (srv.wr.nfailed)
+                sync_writes(&srv);
+            
+            flush_acks(sockfd, acks);
+        }
+    }
+    
+    /* the shards report one after the other */
+    pthread_mutex_lock(&report_lock);
+    
+    if (w->shards > 1) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Shard %d of %d stopping", 
+            w->shard + 1, w->shards);
+        print_smsg(inf_msg_buf);
+    } else {
+        print_smsg("Server stopping");
+    }
+    
+    /* sessions still open are incomplete */
+    while (srv.sessions.oldest) {
+        finish_session(&srv, srv.sessions.oldest);
+        session_remove(&srv.sessions, srv.sessions.oldest);
+    }
+    
+    bool async = srv.wr.ring_fd >= 0;
+    
+    if (!writer_close(&srv.wr))
+        exit_serr(__LINE__, "Writing output file error");
+    
+    close(epfd);
+    close(srv.ack_timer);
+    sessions_free(&srv.sessions);
+    free(srv.dgrams);
+    free(srv.ctrl);
+    free(srv.aligned);
+    free(srv.rebuilt);
+    free(srv.inflated);
+    free(srv.msgs);
+    free(srv.iov);
+    free(srv.addrs);
+    free(acks->msgs);
+    free(acks->iov);
+    free(acks->addrs);
+    free(acks->acks);
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "%ld file transfers complete", 
+        srv.completed);
+    print_smsg(inf_msg_buf);
+    
+    if (srv.failed) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld file transfers failed, digest mismatch", srv.failed);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (srv.parity) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld segments recovered from %ld parity segments", 
+            srv.recovered, srv.parity);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (srv.inflated_segs) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld segments decompressed, %zu bytes to %zu (ratio %.2f) "
+            "in %.1f ms", srv.inflated_segs, srv.packed_bytes, srv.raw_bytes,
+            (double) srv.raw_bytes / srv.packed_bytes, 
+            srv.inflate_usec / 1000.0);
+        print_smsg(inf_msg_buf);
+    }
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Datagrams received in %ld recvmmsg calls (%.2f per call), "
+        "ACKs sent in %ld sendmmsg calls (%.2f per call), batch size: %d",
+        srv.recv_calls, 
+        srv.recv_calls ? (double) srv.recv_dgrams / srv.recv_calls : 0,
+        acks->calls, acks->calls ? (double) acks->sent / acks->calls : 0, 
+        batch_size);
+    print_smsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "%ld segments received in %ld datagrams, %ld coalesced by UDP "
+        "receive offload", srv.recv_segs, srv.recv_dgrams, srv.gro_dgrams);
+    print_smsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "%ld data segments ACKed with %ld ACKs (%.2f per ACK), %ld after "
+        "the ACK delay, ACK policy: every %d segments or %d usec", 
+        srv.acked_segs, acks->sent, 
+        acks->sent ? (double) srv.acked_segs / acks->sent : 0, 
+        srv.delayed_acks, srv.ack_every, srv.ack_delay);
+    print_smsg(inf_msg_buf);
+    
+    if (async) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "File writes: io_uring, %ld writes submitted in %ld calls "
+            "(%.2f per call), max queue depth %d of %d, %ld waits for a "
+            "free buffer", srv.wr.submitted, srv.wr.submits, 
+            srv.wr.submits ? (double) srv.wr.submitted / srv.wr.submits : 0,
+            srv.wr.max_inflight, WRITER_DEPTH, srv.wr.waits);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "File writes: pwrite, %ld writes", srv.wr.writes);
+    }
+    
+    print_smsg(inf_msg_buf);
+    print_sep();
+    print_sep();
+    pthread_mutex_unlock(&report_lock);
+    
+    return NULL;
+}
+
+static void handle_segment(server_t* srv, struct sockaddr_in* from, 
+    segment_t* seg, size_t bytes, long long now) {
+    session_t* s = session_find(&srv->sessions, from, seg->session);
+    
+    /* a delta asks for signatures before its session starts */
+    if (seg->type == DELTA_SEG) {
+        send_sigs(srv, from, seg, bytes);
+        return;
+    }
+    
+    /* as does a transfer that resumes one cut off */
+    if (seg->type == RESUME_SEG) {
+        send_resume(srv, from, seg, bytes);
+        return;
+    }
+    
+    if (seg->type == META_SEG) {
+        /* a new client, or one that did not get the reply to its metadata */
+        if (!s)
+            s = open_session(srv, from, seg, bytes);
+        
+        if (s) {
+            session_touch(&srv->sessions, s, now);
+            send_meta_reply(srv->sockfd, s);
+        }
+        
+        return;
+    }
+    
+    if (!s) {
+        print_smsg("Segment of unknown session dropped");
+        return;
+    }
+    
+    session_touch(&srv->sessions, s, now);
+    
+    /* 
+     * a dropped session (its tree could not be created or a write to it 
+     * failed) is left to expire
+     */
+    if (s->out_fd < 0 && !s->done)
+        return;
+    
+    if (seg->type == PROBE_SEG) {
+        /* echo a path MTU probe without its padding */
+        seg->payload_bytes = 0;
+        
+        if (sendto(srv->sockfd, seg, sizeof(segment_t), 0, 
+                (struct sockaddr*) &s->client, sizeof(struct sockaddr_in)) < 0)
+            print_serr(__LINE__, "Sending probe echo error");
+    } else if (seg->type == DIGEST_SEG) {
+        check_digest(srv, s, seg, bytes);
+    } else if (seg->type == FEC_SEG) {
+        if (process_parity(srv, s, seg, bytes))
+            recover_segment(srv, s, seg->sq);
+    } else {
+        receive_data(srv, s, seg, bytes);
+        
+        /* the segment may be the last but one of its block to arrive */
+        if (s->rwin.fec)
+            recover_segment(srv, s, seg->ack);
+    }
+}
+
+static void receive_data(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes) {
+    if (!process_data_msg(srv, s, seg, bytes) && 
+            !s->done) {
+        s->done = true;
+        srv->completed++;
+        finish_session(srv, s);
+    }
+}
+
+static session_t* open_session(server_t* srv, struct sockaddr_in* from,
+    segment_t* meta_msg, size_t bytes) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    metadata_t file_inf;
+    
+    if (bytes != sizeof(segment_t) + sizeof(metadata_t))
+        return NULL;
+    
+    memcpy(&file_inf, meta_msg->payload, sizeof(metadata_t));
+    file_inf.name[FILE_NAME_SIZE - 1] = '\0';
+    
+    bool delta = file_inf.delta_block != 0;
+    bool whole = delta || (!file_inf.range_offset && 
+        file_inf.range_bytes == file_inf.size);
+    bool tree = file_inf.manifest_bytes != 0;
+    
+    /* the script of a delta may be larger than the file it rebuilds */
+    if (file_inf.size < 0 || file_inf.range_offset < 0 || 
+            file_inf.range_bytes < 0 || (!delta &&
+            (file_inf.range_offset > file_inf.size ||
+            file_inf.range_bytes > file_inf.size - file_inf.range_offset))) {
+        print_smsg("Invalid file size or range in meta data");
+        return NULL;
+    }
+    
+    if (delta && (tree || file_inf.range_offset || 
+            file_inf.delta_block < DELTA_BLOCK_MIN || 
+            file_inf.delta_block > DELTA_BLOCK_MAX)) {
+        print_smsg("Invalid delta in meta data");
+        return NULL;
+    }
+    
+    /* a tree is sent whole, starting with its manifest */
+    if (tree && (!whole || file_inf.manifest_bytes < 0 || 
+            file_inf.manifest_bytes > file_inf.size ||
+            file_inf.manifest_bytes > MANIFEST_MAX)) {
+        print_smsg("Invalid manifest size in meta data");
+        return NULL;
+    }
+    
+    /* agree to the proposed payload size if within the valid range */
+    if (file_inf.payload_size < PAYLOAD_SIZE)
+        file_inf.payload_size = PAYLOAD_SIZE;
+    else if (file_inf.payload_size > PAYLOAD_SIZE_MAX)
+        file_inf.payload_size = PAYLOAD_SIZE_MAX;
+    
+    /* agree to the proposed checksum, or to the byte sum if it is unknown */
+    if (!csum_name(file_inf.csum))
+        file_inf.csum = CSUM_SUM;
+    
+    file_inf.fec = file_inf.fec != 0;
+    file_inf.compress = file_inf.compress != 0;
+    
+    /* ACK at most as many segments at once as the client asks for */
+    if (file_inf.ack_every < 1)
+        file_inf.ack_every = 1;
+    else if (file_inf.ack_every > srv->ack_every)
+        file_inf.ack_every = srv->ack_every;
+    
+    /* a journal is kept of the ranges of a file, not of a tree or a delta */
+    if (tree || delta || !file_inf.range_bytes)
+        file_inf.source = 0;
+    
+    /* 
+     * Open the output file. A range of the file must not truncate what the
+     * sessions of the other ranges have written, the file is only cut to 
+     * its size. The output of a tree is the directory it is created in, a
+     * delta is applied to the file to rebuild it next to it
+     */
+    int out_fd;
+    int basis_fd = -1;
+    off_t basis_bytes = 0;
+    
+    if (tree) {
+        if (mkdir(file_inf.name, 0755) && errno != EEXIST)
+            out_fd = -1;
+        else
+            out_fd = open(file_inf.name, O_RDONLY | O_DIRECTORY);
+    } else if (delta) {
+        char path[FILE_NAME_SIZE + sizeof(DELTA_SUFFIX)];
+        
+        snprintf(path, sizeof(path), "%s%s", file_inf.name, DELTA_SUFFIX);
+        basis_fd = open(file_inf.name, O_RDONLY);
+        basis_bytes = basis_fd < 0 ? -1 : lseek(basis_fd, 0, SEEK_END);
+        out_fd = basis_bytes < 0 ? -1 : 
+            open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    } else {
+        out_fd = open(file_inf.name, O_WRONLY | O_CREAT | 
+            (whole ? O_TRUNC : 0), 0644);
+    }
+    
+    if (out_fd < 0 || (!whole && ftruncate(out_fd, file_inf.size))) {
+        print_serr(__LINE__, "Could not open output file");
+        
+        if (out_fd >= 0)
+            close(out_fd);
+        
+        if (basis_fd >= 0)
+            close(basis_fd);
+        
+        return NULL;
+    }
+    
+    /* 
+     * allocate the whole file up front: segments are written at their 
+     * offsets in any order without growing the file piecemeal, and a full
+     * disk shows before the transfer rather than during it
+     */
+    if (!tree && file_inf.size && fallocate(out_fd, 0, 0, file_inf.size)) {
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            print_serr(__LINE__, "Could not allocate output file");
+            close(out_fd);
+            
+            if (basis_fd >= 0)
+                close(basis_fd);
+            
+            return NULL;
+        }
+        
+        print_smsg("File system does not support preallocation");
+    }
+    
+    session_t* s = session_add(&srv->sessions, from, meta_msg->session);
+    
+    /* the manifest is kept until it is complete and the tree is created */
+    if (s && tree) {
+        s->tree.manifest = malloc(file_inf.manifest_bytes);
+        s->tree.manifest_bytes = file_inf.manifest_bytes;
+        
+        if (!s->tree.manifest) {
+            session_remove(&srv->sessions, s);
+            s = NULL;
+        }
+    }
+    
+    /* 
+     * room for a payload in each slot of the window, allocated once: only 
+     * the pages of the slots that ever hold a payload are touched
+     */
+    if (s) {
+        s->rwin.held_buf = malloc((size_t) WINDOW_MAX * 
+            file_inf.payload_size);
+        
+        if (!s->rwin.held_buf) {
+            session_remove(&srv->sessions, s);
+            s = NULL;
+        }
+    }
+    
+    if (s && file_inf.fec) {
+        s->rwin.fec = calloc(WINDOW_MAX, sizeof(fec_block_t));
+        
+        if (!s->rwin.fec) {
+            session_remove(&srv->sessions, s);
+            s = NULL;
+        }
+    }
+    
+    if (!s) {
+        print_serr(__LINE__, "Could not allocate session");
+        close(out_fd);
+        
+        if (basis_fd >= 0)
+            close(basis_fd);
+        
+        return NULL;
+    }
+    
+    /* 
+     * the journal of the whole file starts empty, that of a range adds to
+     * what the sessions of the other ranges record
+     */
+    if (s && file_inf.source) {
+        s->journal_fd = journal_open(file_inf.name, whole);
+        
+        if (s->journal_fd < 0) {
+            print_serr(__LINE__, "Could not open journal, transfer cannot "
+                "be resumed");
+            file_inf.source = 0;
+        }
+    }
+    
+    s->file_inf = file_inf;
+    s->out_fd = out_fd;
+    s->delta.basis_fd = basis_fd;
+    s->delta.basis_bytes = basis_bytes;
+    s->delta.pending = delta;
+    s->rwin.payload_size = file_inf.payload_size;
+    s->rwin.ack_every = file_inf.ack_every;
+    s->rwin.start = file_inf.range_offset;
+    s->rwin.end = file_inf.range_offset + file_inf.range_bytes;
+    
+    print_sep();
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Session %u: meta data received from %s:%d", s->id, 
+        inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    print_smsg(inf_msg_buf);
+    
+    if (tree) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Output directory: %s, manifest: %ld bytes, expected content: "
+            "%ld bytes, payload size: %d", file_inf.name, 
+            (long) file_inf.manifest_bytes, 
+            (long) (file_inf.size - file_inf.manifest_bytes), 
+            file_inf.payload_size);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Output file name: %s, expected file size: %ld, payload size: %d",
+            file_inf.name, (long) file_inf.size, file_inf.payload_size);
+    }
+    
+    print_smsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Segment checksum: %s (%s)", 
+        csum_name(file_inf.csum), csum_impl(file_inf.csum));
+    print_smsg(inf_msg_buf);
+    
+    if (file_inf.fec)
+        print_smsg("Forward error correction: XOR parity segments");
+    
+    if (file_inf.ack_every > 1) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "ACKs: every %d data segments in sequence or after %d usec", 
+            file_inf.ack_every, srv->ack_delay);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (file_inf.compress)
+        print_smsg("Compression: payloads of data segments (LZ)");
+    
+    if (file_inf.source) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Journal: bytes on disk recorded in %s%s every %d MB", 
+            file_inf.name, JOURNAL_SUFFIX, JOURNAL_BYTES / (1024 * 1024));
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (delta) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Delta: script of %ld bytes against the copy of %ld bytes, "
+            "blocks of %d bytes", (long) file_inf.range_bytes, 
+            (long) basis_bytes, file_inf.delta_block);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (!whole) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Range: bytes %ld to %ld",
+            (long) s->rwin.start, (long) s->rwin.end - 1);
+        print_smsg(inf_msg_buf);
+    }
+    print_sep();
+    
+    // don't wait for empty file
+    if (!file_inf.range_bytes) {
+        s->done = true;
+        srv->completed++;
+        finish_session(srv, s);
+    }
+    
+    return s;
+}
+
+static void finish_session(server_t* srv, session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    
+    /* a rebuilt file whose digest was not confirmed is removed */
+    if (s->out_fd < 0) {
+        if (s->delta.pending)
+            finish_rebuild(s, false);
+        
+        return;
+    }
+    
+    /* the writes to the file must be done before it is closed */
+    sync_writes(srv);
+    
+    if (s->out_fd < 0)
+        return;
+    
+    if (s->file_inf.manifest_bytes) {
+        finish_tree(s);
+        return;
+    }
+    
+    if (s->file_inf.delta_block)
+        finish_delta(s);
+    
+    /* 
+     * the range of a complete session is recorded once its digest matches,
+     * which its bytes must be on disk for, that of one cut off as far as it
+     * got in sequence
+     */
+    if (s->journal_fd >= 0 && s->done && fdatasync(s->out_fd)) {
+        print_serr(__LINE__, "Could not flush output file");
+        close(s->journal_fd);
+        s->journal_fd = -1;
+    } else if (s->journal_fd >= 0 && !s->done) {
+        journal_progress(srv, s);
+    }
+    
+    struct stat stat_buf;
+    fstat(s->out_fd, &stat_buf);
+    
+    if (close(s->out_fd))
+        exit_serr(__LINE__, "Writing output file error");
+    
+    s->out_fd = -1;
+    
+    print_sep();
+    
+    if (s->done) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Session %u: file copying complete", s->id);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Session %u: transfer incomplete, %d segments received in "
+            "sequence", s->id, s->rwin.base);
+    }
+    
+    print_smsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "%ld segments received, %ld duplicate segments ignored", s->segs, 
+        s->rwin.dups);
+    print_smsg(inf_msg_buf);
+    
+    if (s->rwin.fec) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld parity segments received, %ld segments recovered from "
+            "parity", s->rwin.parity, s->rwin.recovered);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (s->rwin.inflated) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld segments decompressed, %zu bytes to %zu (ratio %.2f) in "
+            "%.1f ms", s->rwin.inflated, s->rwin.packed_bytes, 
+            s->rwin.raw_bytes, (double) s->rwin.raw_bytes / 
+            s->rwin.packed_bytes, s->rwin.inflate_usec / 1000.0);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (s->file_inf.delta_block) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld bytes of file %s rebuilt, %ld copied from its old copy and "
+            "%ld from the delta", (long) s->delta.out, s->file_inf.name, 
+            (long) s->delta.copied, (long) (s->delta.out - s->delta.copied));
+    } else if (s->file_inf.range_bytes == s->file_inf.size) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "%ld bytes written to file %s",
+            (long) stat_buf.st_size, s->file_inf.name);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Bytes %ld to %ld of %ld written to file %s", 
+            (long) s->rwin.start, (long) s->rwin.end - 1, 
+            (long) stat_buf.st_size, s->file_inf.name);
+    }
+    
+    print_smsg(inf_msg_buf);
+    print_sep();
+    print_sep();
+}
+
+static void finish_tree(session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    tree_t* tree = &s->tree;
+    off_t bytes = 0;
+    int files = 0;
+    
+    for (int i = 0; i < tree->count; i++) {
+        tree_entry_t* e = &tree->entries[i];
+        
+        if (e->fd >= 0 && close(e->fd))
+            exit_serr(__LINE__, "Writing output file error");
+        
+        e->fd = -1;
+        bytes += e->done;
+        files += S_ISREG(e->mode) && e->done == e->size;
+    }
+    
+    s->nclosing = 0;
+    
+    /* the directories get their modes once nothing more is written to them */
+    if (s->done)
+        tree_finish(tree, s->out_fd);
+    
+    close(s->out_fd);
+    s->out_fd = -1;
+    
+    print_sep();
+    
+    if (s->done) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Session %u: directory copying complete", s->id);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Session %u: transfer incomplete, %d segments received in "
+            "sequence", s->id, s->rwin.base);
+    }
+    
+    print_smsg(inf_msg_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "%ld segments received, %ld duplicate segments ignored", s->segs, 
+        s->rwin.dups);
+    print_smsg(inf_msg_buf);
+    
+    if (s->rwin.fec) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld parity segments received, %ld segments recovered from "
+            "parity", s->rwin.parity, s->rwin.recovered);
+        print_smsg(inf_msg_buf);
+    }
+    
+    if (s->rwin.inflated) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "%ld segments decompressed, %zu bytes to %zu (ratio %.2f) in "
+            "%.1f ms", s->rwin.inflated, s->rwin.packed_bytes, 
+            s->rwin.raw_bytes, (double) s->rwin.raw_bytes / 
+            s->rwin.packed_bytes, s->rwin.inflate_usec / 1000.0);
+        print_smsg(inf_msg_buf);
+    }
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "%d of %d files (%ld bytes) and %d directories written to "
+        "directory %s", files, tree->files, (long) bytes, tree->dirs, 
+        s->file_inf.name);
+    print_smsg(inf_msg_buf);
+    print_sep();
+    print_sep();
+}
+
+static bool tree_ready(session_t* s, segment_t* seg) {
+    off_t manifest_end = s->file_inf.manifest_bytes;
+    
+    if (!manifest_end || s->tree.entries || 
+            seg->offset + (off_t) seg->payload_bytes <= manifest_end)
+        return true;
+    
+    /* the segment with the last bytes of the manifest still missing */
+    return seg->offset < manifest_end && 
+        s->manifest_have + (manifest_end - seg->offset) == 
+            (size_t) manifest_end;
+}
+
+static bool write_payload(server_t* srv, session_t* s, segment_t* seg) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    file_writer_t* wr = &srv->wr;
+    tree_t* tree = &s->tree;
+    char* data = seg->payload;
+    size_t len = seg->payload_bytes;
+    off_t offset = seg->offset;
+    
+    /* a delta script is applied in sequence, by take_payload */
+    if (s->file_inf.delta_block)
+        return true;
+    
+    /* a file: one write at the offset of the payload */
+    if (!s->file_inf.manifest_bytes) {
+        char* buf = writer_buf(wr);
+        
+        if (!buf)
+            exit_serr(__LINE__, "Writing output file error");
+        
+        memcpy(buf, data, len);
+        writer_write(wr, s->out_fd, buf, len, offset);
+        
+        return true;
+    }
+    
+    /* a tree: first the manifest, which is kept in memory */
+    if ((size_t) offset < tree->manifest_bytes) {
+        size_t n = tree->manifest_bytes - offset < len ? 
+            tree->manifest_bytes - offset : len;
+        
+        memcpy(tree->manifest + offset, data, n);
+        s->manifest_have += n;
+        data += n;
+        len -= n;
+        offset += n;
+        
+        if (s->manifest_have == tree->manifest_bytes) {
+            if (!tree_parse(tree) || tree->manifest_bytes + tree->bytes != 
+                    (size_t) s->file_inf.size) {
+                print_smsg("Invalid manifest of directory");
+                return drop_tree(srv, s);
+            }
+            
+            if (!tree_create(tree, s->out_fd)) {
+                print_serr(__LINE__, "Could not create directory tree");
+                return drop_tree(srv, s);
+            }
+            
+            snprintf(inf_msg_buf, INF_MSG_SIZE, 
+                "Session %u: manifest received, %d files in %d directories",
+                s->id, tree->files, tree->dirs);
+            print_smsg(inf_msg_buf);
+        }
+    }
+    
+    /* then the parts of the payload in each file it spans */
+    for (int i = len ? tree_find(tree, offset) : 0; len > 0; i++) {
+        tree_entry_t* e = &tree->entries[i];
+        
+        /* directories and empty files take no bytes of the stream */
+        if (offset >= e->offset + e->size)
+            continue;
+        
+        size_t n = e->offset + e->size - offset < (off_t) len ? 
+            (size_t) (e->offset + e->size - offset) : len;
+        
+        if (e->fd < 0 && tree_open(tree, i, s->out_fd, true) < 0) {
+            print_serr(__LINE__, "Could not create output file");
+            return drop_tree(srv, s);
+        }
+        
+        char* buf = writer_buf(wr);
+        
+        if (!buf)
+            exit_serr(__LINE__, "Writing output file error");
+        
+        memcpy(buf, data, n);
+        writer_write(wr, e->fd, buf, n, offset - e->offset);
+        
+        /* files written to the end are closed a batch at a time */
+        e->done += n;
+        
+        if (e->done == e->size) {
+            s->closing[s->nclosing++] = i;
+            
+            if (s->nclosing == CLOSE_BATCH && !close_files(srv, s))
+                return false;
+        }
+        
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    
+    return true;
+}
+
+static bool drop_tree(server_t* srv, session_t* s) {
+    sync_writes(srv);
+    
+    /* a write to the tree may have failed and dropped it already */
+    if (s->out_fd >= 0)
+        drop_session(s);
+    
+    return false;
+}
+
+static void drop_session(session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Session %u: transfer dropped", 
+        s->id);
+    print_smsg(inf_msg_buf);
+    tree_free(&s->tree);
+    close(s->out_fd);
+    s->out_fd = -1;
+    
+    /* the ranges journaled so far are on disk, the journal keeps them */
+    if (s->journal_fd >= 0) {
+        close(s->journal_fd);
+        s->journal_fd = -1;
+    }
+}
+
+static void sync_writes(server_t* srv) {
+    write_req_t req;
+    
+    if (!writer_sync(&srv->wr))
+        exit_serr(__LINE__, "Writing output file error");
+    
+    while (writer_failed(&srv->wr, &req)) {
+        session_t* s = write_owner(srv, req.fd);
+        
+        if (!s)
+            continue;
+        
+        errno = req.error;
+        print_serr(__LINE__, "Writing output file error");
+        
+        /* a session that was complete is not, its client is not answered */
+        if (s->done) {
+            s->done = false;
+            srv->completed--;
+        }
+        
+        drop_session(s);
+    }
+}
+
+static session_t* write_owner(server_t* srv, int fd) {
+    for (session_t* s = srv->sessions.oldest; s; s = s->newer) {
+        if (s->out_fd < 0)
+            continue;
+        
+        /* the files of a tree are written, its directory is not */
+        if (!s->file_inf.manifest_bytes && s->out_fd == fd)
+            return s;
+        
+        for (int i = 0; i < s->tree.count; i++) {
+            if (s->tree.entries[i].fd == fd)
+                return s;
+        }
+    }
+    
+    return NULL;
+}
+
+static bool close_files(server_t* srv, session_t* s) {
+    sync_writes(srv);
+    
+    if (s->out_fd < 0)
+        return false;
+    
+    for (int i = 0; i < s->nclosing; i++) {
+        tree_entry_t* e = &s->tree.entries[s->closing[i]];
+        
+        if (close(e->fd))
+            exit_serr(__LINE__, "Writing output file error");
+        
+        e->fd = -1;
+    }
+    
+    s->nclosing = 0;
+    
+    return true;
+}
+
+static int expire_sessions(server_t* srv, long long now) {
+    session_t* s;
+    
+    /* 
+     * a complete session is kept until it is idle so that the client's 
+     * resends of segments whose ACKs were lost are ACKed again
+     */
+    while ((s = srv->sessions.oldest) && 
+            now - s->last_active >= SESSION_IDLE_USEC) {
+        finish_session(srv, s);
+        session_remove(&srv->sessions, s);
+    }
+    
+    if (!s)
+        return -1;
+    
+    return (int) ((s->last_active + SESSION_IDLE_USEC - now) / 1000) + 1;
+}
+
+static void send_meta_reply(int sockfd, session_t* s) {
+    size_t meta_size = sizeof(segment_t) + sizeof(metadata_t);
+    segment_t* reply = calloc(1, meta_size);
+    
+    if (!reply)
+        exit_serr(__LINE__, "Could not allocate metadata segment");
+    
+    reply->session = s->id;
+    reply->type = META_SEG;
+    reply->payload_bytes = sizeof(metadata_t);
+    memcpy(reply->payload, &s->file_inf, sizeof(metadata_t));
+    
+    if (sendto(sockfd, reply, meta_size, 0, (struct sockaddr*) &s->client, 
+            sizeof(struct sockaddr_in)) < 0)
+        print_serr(__LINE__, "Sending metadata reply error");
+    
+    free(reply);
+}
+
+static void check_digest(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    digest_t client;
+    digest_t server = { .digest = xxh64_digest(&s->digest), 
+        .bytes = s->digest.total };
+    
+    /* the client sends its digest again until the session is complete */
+    if (!s->done || bytes != sizeof(segment_t) + sizeof(digest_t))
+        return;
+    
+    memcpy(&client, seg->payload, sizeof(digest_t));
+    
+    /* compared once, a resend (the reply was lost) is only answered */
+    if (!s->verified) {
+        s->verified = true;
+        print_sep();
+        
+        if (client.digest == server.digest && client.bytes == server.bytes) {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, 
+                "Session %u: digest %016llx of %ld bytes matches the client's",
+                s->id, (unsigned long long) server.digest, 
+                (long) server.bytes);
+            print_smsg(inf_msg_buf);
+            
+            if (s->delta.pending)
+                finish_rebuild(s, true);
+            
+            if (s->journal_fd >= 0)
+                finish_journal(s);
+        } else {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, 
+                "Session %u: digest %016llx of %ld bytes does NOT match the "
+                "client's %016llx of %ld bytes, transfer failed", s->id, 
+                (unsigned long long) server.digest, (long) server.bytes, 
+                (unsigned long long) client.digest, (long) client.bytes);
+            print_smsg(inf_msg_buf);
+            srv->completed--;
+            srv->failed++;
+            
+            if (s->delta.pending)
+                finish_rebuild(s, false);
+        }
+        
+        print_sep();
+    }
+    
+    memcpy(seg->payload, &server, sizeof(digest_t));
+    
+    if (sendto(srv->sockfd, seg, bytes, 0, (struct sockaddr*) &s->client, 
+            sizeof(struct sockaddr_in)) < 0)
+        print_serr(__LINE__, "Sending digest reply error");
+}
+
+static bool enable_gro(int sockfd) {
+#ifdef UDP_GRO
+    int on = 1;
+    
+    return !setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+#else
+    return false;
+#endif
+}
+
+static size_t gro_seg_size(struct msghdr* hdr, size_t len) {
+#ifdef UDP_GRO
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm; 
+            cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg_size = *(int*) CMSG_DATA(cm);
+            
+            if (seg_size > 0 && (size_t) seg_size < len)
+                return seg_size;
+        }
+    }
+#endif
+
+    return len;
+}
+
+static void flush_acks(int sockfd, ack_batch_t* acks) {
+    int done = 0;
+    
+    while (done < acks->len) {
+        int n = sendmmsg(sockfd, acks->msgs + done, acks->len - done, 0);
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        
+        acks->calls++;
+        
+        if (n < 0) {
+            print_serr(__LINE__, "Sending stream message error");
+            break;
+        }
+        
+        for (int i = 0; i < n; i++)
+            printf("        >>>> NETWORK: ACK sent successfully <<<<\n");
+        
+        done += n;
+        acks->sent += n;
+    }
+    
+    acks->len = 0;
+}
+
+static bool process_data_msg(server_t* srv, session_t* s, segment_t* data_msg,
+    size_t bytes) {
+    recv_window_t* rwin = &s->rwin;
+    bool receiving = true;
+    char inf_msg_buf[INF_MSG_SIZE];
+
+    if (s->first_seg) {
+        /* first segment to be received */
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Session %u: file transfer started",
+            s->id);
+        print_smsg(inf_msg_buf); 
+        print_sep();
+    }
+    
+    s->segs++;
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Received segment with sq: %d, payload bytes: %zu, checksum: %d", 
+        data_msg->sq, data_msg->payload_bytes, data_msg->checksum);
+    print_smsg(inf_msg_buf);
+    
+    if (bytes < sizeof(segment_t) || 
+            data_msg->payload_bytes > (size_t) rwin->payload_size ||
+            bytes != sizeof(segment_t) + data_msg->payload_bytes ||
+            data_msg->offset < rwin->start || data_msg->offset > rwin->end ||
+            (off_t) data_msg->payload_bytes > rwin->end - data_msg->offset) {
+        print_smsg("Segment size does not match payload bytes or file");
+        print_smsg("Did NOT send any ACK");
+        print_sep();
+        return receiving;
+    }
+
+    int cs = seg_checksum(s->file_inf.csum, data_msg, data_msg->payload, 
+        false);
+
+    /* 
+     * If the calculated checksum is same as that of recieved 
+     * checksum then send corrosponding ack
+     */
+    if (cs == data_msg->checksum) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Calculated checksum %d VALID",
+            cs);
+        print_smsg(inf_msg_buf);
+        
+        /* 
+         * Segments beyond the receive window are dropped without ACK, the 
+         * client resends them once the window has moved on
+         */
+        if (data_msg->sq >= rwin->base + WINDOW_MAX) {
+            print_smsg("Segment outside receive window");
+            print_smsg("Did NOT send any ACK");
+            print_sep();
+            return receiving;
+        }
+    
+        /* 
+         * queue the write of the payload at its offset unless the segment 
+         * is a resend of one already written (its ACK was lost): a 
+         * duplicate is only ACKed again
+         */
+        int slot = data_msg->sq % WINDOW_MAX;
+        
+        int old_base = rwin->base;
+        
+        if (!s->done && data_msg->sq >= rwin->base && !rwin->received[slot]) {
+            /* the payload is written and hashed as the client read it */
+            if (data_msg->compressed) {
+                data_msg = inflate_seg(srv, s, data_msg);
+                
+                if (!data_msg) {
+                    print_smsg("Segment could not be decompressed");
+                    print_smsg("Did NOT send any ACK");
+                    print_sep();
+                    return receiving;
+                }
+            }
+            
+            /* 
+             * the content of a tree before its manifest is complete is not
+             * ACKed, the client sends it again
+             */
+            if (!tree_ready(s, data_msg)) {
+                print_smsg("Manifest of directory not complete");
+                print_smsg("Did NOT send any ACK");
+                print_sep();
+                return receiving;
+            }
+            
+            if (!write_payload(srv, s, data_msg)) {
+                print_smsg("Did NOT send any ACK");
+                print_sep();
+                return receiving;
+            }
+            
+            rwin->received[slot] = true;
+            
+            if (data_msg->sq > rwin->base)
+                rwin->ahead++;
+            
+            /* 
+             * the digest (or the delta) takes the bytes in offset order: a
+             * segment in sequence now, one above it once the segments 
+             * before it are in
+             */
+            if (data_msg->sq == rwin->base) {
+                take_payload(srv, s, data_msg->payload, 
+                    data_msg->payload_bytes);
+            } else {
+                held_payload_t* h = &rwin->held[slot];
+                
+                h->data = rwin->held_buf + (size_t) slot * rwin->payload_size;
+                h->len = data_msg->payload_bytes;
+                memcpy(h->data, data_msg->payload, h->len);
+            }
+            
+            if (rwin->fec)
+                fec_data(rwin, data_msg);
+            
+            if (data_msg->last)
+                rwin->last_sq = data_msg->sq;
+        } else {
+            rwin->dups++;
+        }
+        
+        /* move the cumulative ACK point past the segments now in sequence */
+        while (rwin->received[rwin->base % WINDOW_MAX]) {
+            held_payload_t* h = &rwin->held[rwin->base % WINDOW_MAX];
+            
+            if (h->data) {
+                take_payload(srv, s, h->data, h->len);
+                h->data = NULL;
+            }
+            
+            rwin->received[rwin->base % WINDOW_MAX] = false;
+            
+            if (rwin->base != data_msg->sq)
+                rwin->ahead--;
+            
+            rwin->base++;
+            
+            /* no segment of a block this far behind can be missing */
+            if (rwin->fec && rwin->base >= FEC_K_MAX && 
+                    rwin->fec[(rwin->base - FEC_K_MAX) % WINDOW_MAX].first == 
+                    rwin->base - FEC_K_MAX)
+                fec_drop(&rwin->fec[(rwin->base - FEC_K_MAX) % WINDOW_MAX]);
+        }
+    
+        /* 
+         * ACK at once a segment out of order (there is a gap below it), a
+         * duplicate (the client may not have the ACK of it), one that 
+         * fills a gap, one the client waits for and the last one, else 
+         * every ack_every segments in sequence or once the ACK delay is 
+         * over
+         */
+        rwin->ack_sq = data_msg->sq;
+        rwin->unacked++;
+        
+        if (data_msg->sq != old_base || rwin->base > old_base + 1 || 
+                rwin->ahead || data_msg->last || data_msg->ack_now ||
+                rwin->unacked >= rwin->ack_every)
+            queue_ack(srv, s);
+        else
+            delay_ack(srv, s);
+        
+        s->first_seg = false;
+     
+        print_sep();
+        print_sep();
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Segment checksum %d INVALID",
+            cs);
+        print_smsg(inf_msg_buf);
+        print_smsg("Did NOT send any ACK");
+        print_sep();
+    }    
+    
+    /* still receiving until the last segment and all before it are written */
+    receiving = rwin->last_sq < 0 || rwin->base <= rwin->last_sq;
+    
+    return receiving;
+}
+
+static void queue_ack(server_t* srv, session_t* s) {
+    ack_batch_t* acks = &srv->acks;
+    recv_window_t* rwin = &s->rwin;
+    char inf_msg_buf[INF_MSG_SIZE];
+    
+    /* 
+     * Prepare the Ack segment: cumulative ACK of the segments received
+     * in sequence and a selective ACK of those received above it
+     */
+    segment_t* ack_msg = (segment_t*) (acks->acks + acks->len * ACK_SIZE);
+    memset(ack_msg, 0, ACK_SIZE);
+    ack_msg->session = s->id;
+    ack_msg->sq = rwin->ack_sq;
+    ack_msg->type= ACK_SEG;
+    ack_msg->ack = rwin->base;
+    ack_msg->offset = rwin->recovered;
+    
+    for (int i = 0; rwin->ahead && i < SACK_BITS && i < WINDOW_MAX - 1; 
+            i++) {
+        if (rwin->received[(rwin->base + 1 + i) % WINDOW_MAX]) {
+            sack_set(ack_msg->payload, i);
+            ack_msg->payload_bytes = i / 8 + 1;
+        }
+    }
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Sending ACK with sq: %d, cumulative ACK: %d", ack_msg->sq, 
+        ack_msg->ack);
+    print_smsg(inf_msg_buf);
+    
+    /* queue the Ack segment, it is sent with the rest of the batch */
+    memcpy(&acks->addrs[acks->len], &s->client, sizeof(struct sockaddr_in));
+    acks->iov[acks->len].iov_base = ack_msg;
+    acks->iov[acks->len].iov_len = sizeof(segment_t) + 
+        ack_msg->payload_bytes;
+    acks->len++;
+    srv->acked_segs += rwin->unacked;
+    rwin->unacked = 0;
+}
+
+static void delay_ack(server_t* srv, session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    struct itimerspec delay = { .it_value = { .tv_sec = 0, 
+        .tv_nsec = srv->ack_delay * 1000L } };
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "ACK of sq: %d held back, %d segments not ACKed", s->rwin.ack_sq, 
+        s->rwin.unacked);
+    print_smsg(inf_msg_buf);
+    
+    /* the timer is set for the first ACK held back, it sends them all */
+    if (srv->ack_armed)
+        return;
+    
+    if (timerfd_settime(srv->ack_timer, 0, &delay, NULL))
+        exit_serr(__LINE__, "Could not set ACK timer");
+    
+    srv->ack_armed = s->last_active;
+}
+
+static void send_delayed_acks(server_t* srv) {
+    uint64_t expired;
+    
+    if (read(srv->ack_timer, &expired, sizeof(expired)) < 0 && 
+            errno != EAGAIN)
+        exit_serr(__LINE__, "Reading ACK timer error");
+    
+    /* 
+     * the sessions with an ACK held back are those with a segment since 
+     * the timer was set, the most recently active ones
+     */
+    for (session_t* s = srv->sessions.newest; 
+            s && srv->ack_armed && s->last_active >= srv->ack_armed; 
+            s = s->older) {
+        if (!s->rwin.unacked)
+            continue;
+        
+        if (srv->acks.len == srv->acks.max)
+            flush_acks(srv->sockfd, &srv->acks);
+        
+        queue_ack(srv, s);
+        srv->delayed_acks++;
+    }
+    
+    srv->ack_armed = 0;
+    flush_acks(srv->sockfd, &srv->acks);
+}
+
+static segment_t* inflate_seg(server_t* srv, session_t* s, segment_t* seg) {
+    recv_window_t* rwin = &s->rwin;
+    segment_t* raw = srv->inflated;
+    
+    if (!s->file_inf.compress)
+        return NULL;
+    
+    long long start = now_usec();
+    ssize_t len = lz_decompress(seg->payload, seg->payload_bytes, 
+        raw->payload, rwin->payload_size);
+    
+    if (len < 0 || (off_t) len > rwin->end - seg->offset)
+        return NULL;
+    
+    memcpy(raw, seg, sizeof(segment_t));
+    raw->payload_bytes = len;
+    raw->compressed = false;
+    
+    long long usec = now_usec() - start;
+    
+    rwin->inflated++;
+    rwin->packed_bytes += seg->payload_bytes;
+    rwin->raw_bytes += len;
+    rwin->inflate_usec += usec;
+    srv->inflated_segs++;
+    srv->packed_bytes += seg->payload_bytes;
+    srv->raw_bytes += len;
+    srv->inflate_usec += usec;
+    
+    return raw;
+}
+
+static void take_payload(server_t* srv, session_t* s, char* data, 
+    size_t len) {
+    /* a session dropped on a failed write takes no more bytes */
+    if (s->out_fd < 0)
+        return;
+    
+    if (s->file_inf.delta_block) {
+        apply_delta(srv, s, data, len);
+        return;
+    }
+    
+    xxh64_update(&s->digest, data, len);
+    
+    if (s->journal_fd >= 0 && 
+            s->digest.total - s->journaled >= JOURNAL_BYTES)
+        journal_progress(srv, s);
+}
+
+static void journal_progress(server_t* srv, session_t* s) {
+    off_t end = s->rwin.start + s->digest.total;
+    
+    if (s->digest.total == s->journaled)
+        return;
+    
+    /* the record must not get to the disk before the bytes it records */
+    sync_writes(srv);
+    
+    if (s->out_fd < 0)
+        return;
+    
+    if (fdatasync(s->out_fd) || !journal_append(s->journal_fd, 
+            s->file_inf.source, s->file_inf.size, s->rwin.start, end)) {
+        print_serr(__LINE__, "Could not write journal, transfer cannot be "
+            "resumed");
+        close(s->journal_fd);
+        s->journal_fd = -1;
+        return;
+    }
+    
+    s->journaled = s->digest.total;
+}
+
+static void finish_journal(session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    journal_range_t durable;
+    
+    if (!journal_append(s->journal_fd, s->file_inf.source, s->file_inf.size,
+            s->rwin.start, s->rwin.end)) {
+        print_serr(__LINE__, "Could not write journal");
+    } else if (journal_ranges(s->file_inf.name, s->file_inf.source, 
+            s->file_inf.size, &durable, 1) == 1 && !durable.start && 
+            durable.end == s->file_inf.size) {
+        /* the last range of the file to get to the disk */
+        journal_remove(s->file_inf.name);
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Session %u: file %s complete on disk, journal removed", s->id,
+            s->file_inf.name);
+        print_smsg(inf_msg_buf);
+    }
+    
+    close(s->journal_fd);
+    s->journal_fd = -1;
+}
+
+static void apply_delta(server_t* srv, session_t* s, char* data, size_t len) {
+    delta_apply_t* d = &s->delta;
+    
+    while (len && !d->failed) {
+        /* the op, which may start in one segment and end in the next */
+        if (d->have < sizeof(delta_op_t)) {
+            size_t n = sizeof(delta_op_t) - d->have < len ? 
+                sizeof(delta_op_t) - d->have : len;
+            
+            memcpy((char*) &d->op + d->have, data, n);
+            d->have += n;
+            data += n;
+            len -= n;
+            
+            if (d->have < sizeof(delta_op_t))
+                continue;
+            
+            off_t from = (off_t) d->op.block * s->file_inf.delta_block;
+            
+            if (d->op.len > s->file_inf.size - d->out || 
+                    (d->op.block != DELTA_LITERAL && (d->op.block < 0 || 
+                    d->op.len > d->basis_bytes - from))) {
+                print_smsg("Delta script does not fit the file or its copy");
+                d->failed = true;
+                return;
+            }
+            
+            d->left = d->op.len;
+            
+            /* a copy is written at once, literal bytes as they arrive */
+            if (d->op.block != DELTA_LITERAL)
+                copy_basis(srv, s, from);
+        } else {
+            size_t n = d->left < len ? d->left : len;
+            char* buf = writer_buf(&srv->wr);
+            
+            if (!buf)
+                exit_serr(__LINE__, "Writing output file error");
+            
+            memcpy(buf, data, n);
+            writer_write(&srv->wr, s->out_fd, buf, n, d->out);
+            
+            xxh64_update(&s->digest, data, n);
+            d->out += n;
+            d->left -= n;
+            data += n;
+            len -= n;
+        }
+        
+        if (!d->left)
+            d->have = 0;
+    }
+}
+
+static void copy_basis(server_t* srv, session_t* s, off_t from) {
+    delta_apply_t* d = &s->delta;
+    
+    while (d->left) {
+        size_t n = d->left < srv->wr.buf_size ? d->left : srv->wr.buf_size;
+        char* buf = writer_buf(&srv->wr);
+        
+        if (!buf)
+            exit_serr(__LINE__, "Writing output file error");
+        
+        /* bytes of a copy changed under the server fail the transfer */
+        if (pread(d->basis_fd, buf, n, from) != (ssize_t) n) {
+            print_serr(__LINE__, "Could not read the copy of the file");
+            memset(buf, 0, n);
+            d->failed = true;
+        }
+        
+        xxh64_update(&s->digest, buf, n);
+        
+        writer_write(&srv->wr, s->out_fd, buf, n, d->out);
+        
+        d->out += n;
+        d->copied += n;
+        d->left -= n;
+        from += n;
+    }
+}
+
+static void finish_delta(session_t* s) {
+    delta_apply_t* d = &s->delta;
+    
+    /* the old copy is kept unless the new file is complete */
+    if (!s->done || d->failed || d->out != s->file_inf.size)
+        finish_rebuild(s, false);
+    
+    if (d->basis_fd >= 0)
+        close(d->basis_fd);
+    
+    d->basis_fd = -1;
+}
+
+static void finish_rebuild(session_t* s, bool matched) {
+    char path[FILE_NAME_SIZE + sizeof(DELTA_SUFFIX)];
+    
+    snprintf(path, sizeof(path), "%s%s", s->file_inf.name, DELTA_SUFFIX);
+    s->delta.pending = false;
+    
+    if (!matched) {
+        print_smsg("Delta not applied, the copy of the file is left as it "
+            "was");
+        unlink(path);
+    } else if (rename(path, s->file_inf.name)) {
+        print_serr(__LINE__, "Could not replace the copy of the file");
+    }
+}
+
+static void send_sigs(server_t* srv, struct sockaddr_in* from, segment_t* seg,
+    size_t bytes) {
+    delta_req_t req;
+    int max_sigs = (int) ((DGRAM_SIZE_MAX - sizeof(segment_t) - 
+        sizeof(delta_sigs_t)) / sizeof(delta_sig_t));
+    
+    if (bytes != sizeof(segment_t) + sizeof(delta_req_t))
+        return;
+    
+    memcpy(&req, seg->payload, sizeof(delta_req_t));
+    req.name[FILE_NAME_SIZE - 1] = '\0';
+    
+    if (req.max < 1 || req.max > max_sigs)
+        req.max = max_sigs;
+    
+    /* 
+     * only the full blocks of a regular file have signatures, of a file
+     * below the directory of the server as the paths of a tree must be
+     */
+    delta_sigs_t hdr = { .basis_bytes = -1, .first = req.first };
+    struct stat stat_buf;
+    int fd = tree_path_valid(req.name, strlen(req.name)) ? 
+        open(req.name, O_RDONLY) : -1;
+    
+    if (fd >= 0 && !fstat(fd, &stat_buf) && S_ISREG(stat_buf.st_mode) && 
+            req.first >= 0) {
+        off_t blocks;
+        
+        hdr.basis_bytes = stat_buf.st_size;
+        hdr.block_size = delta_block_size(stat_buf.st_size);
+        blocks = stat_buf.st_size / hdr.block_size;
+        
+        if (req.first < blocks)
+            hdr.count = blocks - req.first < req.max ? 
+                (int) (blocks - req.first) : req.max;
+    }
+    
+    size_t reply_size = sizeof(segment_t) + sizeof(delta_sigs_t) + 
+        hdr.count * sizeof(delta_sig_t);
+    segment_t* reply = calloc(1, reply_size);
+    
+    if (!reply)
+        exit_serr(__LINE__, "Could not allocate signature segment");
+    
+    delta_sig_t* sigs = (delta_sig_t*) (reply->payload + 
+        sizeof(delta_sigs_t));
+    
+    if (hdr.count && 
+            !delta_sign(fd, hdr.block_size, hdr.first, hdr.count, sigs)) {
+        print_serr(__LINE__, "Could not read the blocks of a file");
+        hdr.basis_bytes = -1;
+        hdr.count = 0;
+        reply_size = sizeof(segment_t) + sizeof(delta_sigs_t);
+    }
+    
+    if (fd >= 0)
+        close(fd);
+    
+    reply->session = seg->session;
+    reply->sq = seg->sq;
+    reply->type = DELTA_SEG;
+    reply->payload_bytes = reply_size - sizeof(segment_t);
+    memcpy(reply->payload, &hdr, sizeof(delta_sigs_t));
+    
+    if (sendto(srv->sockfd, reply, reply_size, 0, (struct sockaddr*) from, 
+            sizeof(struct sockaddr_in)) < 0)
+        print_serr(__LINE__, "Sending signatures error");
+    
+    free(reply);
+}
+
+static void send_resume(server_t* srv, struct sockaddr_in* from, 
+    segment_t* seg, size_t bytes) {
+    size_t reply_size = sizeof(segment_t) + sizeof(resume_t);
+    resume_req_t req;
+    resume_t durable;
+    struct stat stat_buf;
+    
+    if (bytes != sizeof(segment_t) + sizeof(resume_req_t))
+        return;
+    
+    memcpy(&req, seg->payload, sizeof(resume_req_t));
+    req.name[FILE_NAME_SIZE - 1] = '\0';
+    memset(&durable, 0, sizeof(resume_t));
+    
+    /* 
+     * what is journaled counts as long as the file is still there, a file
+     * below the directory of the server as for signatures
+     */
+    if (req.source && tree_path_valid(req.name, strlen(req.name)) && 
+            !stat(req.name, &stat_buf) && 
+            S_ISREG(stat_buf.st_mode) && stat_buf.st_size == req.size)
+        durable.count = journal_ranges(req.name, req.source, req.size, 
+            durable.ranges, RESUME_RANGES_MAX);
+    
+    segment_t* reply = calloc(1, reply_size);
+    
+    if (!reply)
+        exit_serr(__LINE__, "Could not allocate resume segment");
+    
+    reply->session = seg->session;
+    reply->sq = seg->sq;
+    reply->type = RESUME_SEG;
+    reply->payload_bytes = sizeof(resume_t);
+    memcpy(reply->payload, &durable, sizeof(resume_t));
+    
+    if (sendto(srv->sockfd, reply, reply_size, 0, (struct sockaddr*) from,
+            sizeof(struct sockaddr_in)) < 0)
+        print_serr(__LINE__, "Sending resume reply error");
+    
+    free(reply);
+}
+
+static void fec_data(recv_window_t* rwin, segment_t* seg) {
+    int first = seg->ack;
+    
+    if (first < 0 || first > seg->sq || seg->sq - first >= FEC_K_MAX)
+        return;
+    
+    fec_block_t* b = fec_block(rwin->fec, first, rwin->payload_size);
+    
+    if (!b)
+        exit_serr(__LINE__, "Could not allocate parity block");
+    
+    if (b->count && seg->sq >= first + b->count)
+        return;
+    
+    fec_xor(b->xor, seg->payload, seg->payload_bytes);
+    b->have++;
+    
+    if (b->have == b->count)
+        fec_drop(b);
+}
+
+static bool process_parity(server_t* srv, session_t* s, segment_t* seg, 
+    size_t bytes) {
+    recv_window_t* rwin = &s->rwin;
+    char inf_msg_buf[INF_MSG_SIZE];
+    
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Received parity segment for sq: %d to %d, payload bytes: %zu", 
+        seg->sq, seg->sq + seg->ack - 1, seg->payload_bytes);
+    print_smsg(inf_msg_buf);
+    
+    if (!rwin->fec || s->done || 
+            bytes != sizeof(segment_t) + seg->payload_bytes ||
+            !seg->payload_bytes || 
+            seg->payload_bytes > (size_t) rwin->payload_size ||
+            seg->ack < 1 || seg->ack > FEC_K_MAX || seg->sq < 0 || 
+            seg->sq + seg->ack > rwin->base + WINDOW_MAX ||
+            seg->checksum != seg_checksum(s->file_inf.csum, seg, 
+                seg->payload, false)) {
+        print_smsg("Parity segment dropped");
+        print_sep();
+        return false;
+    }
+    
+    rwin->parity++;
+    srv->parity++;
+    
+    /* all segments of the block are in already */
+    if (seg->sq + seg->ack <= rwin->base)
+        return false;
+    
+    fec_block_t* b = fec_block(rwin->fec, seg->sq, rwin->payload_size);
+    
+    if (!b)
+        exit_serr(__LINE__, "Could not allocate parity block");
+    
+    /* a parity segment the client sent again */
+    if (b->count)
+        return false;
+    
+    b->count = seg->ack;
+    b->offset = seg->offset;
+    b->len = seg->payload_bytes;
+    fec_xor(b->xor, seg->payload, seg->payload_bytes);
+    
+    return true;
+}
+
+static void recover_segment(server_t* srv, session_t* s, int first) {
+    recv_window_t* rwin = &s->rwin;
+    char inf_msg_buf[INF_MSG_SIZE];
+    
+    if (first < 0 || s->done)
+        return;
+    
+    fec_block_t* b = &rwin->fec[first % WINDOW_MAX];
+    
+    if (!b->xor || b->first != first || !b->count)
+        return;
+    
+    /* the segments of the block still missing */
+    int missing = -1;
+    int lost = 0;
+    
+    for (int sq = first; sq < first + b->count; sq++) {
+        if (sq >= rwin->base && !rwin->received[sq % WINDOW_MAX]) {
+            missing = sq;
+            lost++;
+        }
+    }
+    
+    if (!lost) {
+        fec_drop(b);
+        return;
+    }
+    
+    /* the XOR is the payload of the missing segment once all others are in */
+    if (lost > 1 || b->have != b->count - 1)
+        return;
+    
+    segment_t* seg = srv->rebuilt;
+    off_t offset = b->offset + (off_t) (missing - first) * b->len;
+    
+    if (offset < rwin->start || offset >= rwin->end) {
+        fec_drop(b);
+        return;
+    }
+    
+    memset(seg, 0, sizeof(segment_t));
+    seg->session = s->id;
+    seg->sq = missing;
+    seg->type = DATA_SEG;
+    seg->ack = first;
+    seg->offset = offset;
+    seg->payload_bytes = rwin->end - offset < (off_t) b->len ? 
+        (size_t) (rwin->end - offset) : b->len;
+    seg->last = offset + (off_t) seg->payload_bytes == rwin->end;
+    memcpy(seg->payload, b->xor, seg->payload_bytes);
+    seg->checksum = seg_checksum(s->file_inf.csum, seg, seg->payload, false);
+    
+    rwin->recovered++;
+    srv->recovered++;
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Segment with sq: %d recovered from parity", missing);
+    print_smsg(inf_msg_buf);
+    
+    /* the recovered segment is ACKed like one received */
+    if (srv->acks.len == srv->acks.max)
+        flush_acks(srv->sockfd, &srv->acks);
+    
+    receive_data(srv, s, seg, sizeof(segment_t) + seg->payload_bytes);
 }
 
 static void print_smsg(char* msg) {
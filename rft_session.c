@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rft_session.h"
+
+/* mix the key of a session into a hash */
+static size_t session_hash(struct sockaddr_in* client, uint32_t id) {
+    uint64_t h = (uint64_t) client->sin_addr.s_addr << 32 |
+        (uint64_t) client->sin_port << 16;
+
+    h ^= id * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+
+    return (size_t) h;
+}
+
+static bool session_match(session_t* s, struct sockaddr_in* client,
+    uint32_t id) {
+    return s->id == id && s->client.sin_addr.s_addr == client->sin_addr.s_addr
+        && s->client.sin_port == client->sin_port;
+}
+
+/* double the buckets of the table, rehashing the sessions */
+static void sessions_grow(session_table_t* t) {
+    size_t size = t->size * 2;
+    session_t** buckets = calloc(size, sizeof(session_t*));
+
+    /* keep the table as it is, it only gets slower */
+    if (!buckets)
+        return;
+
+    for (size_t i = 0; i < t->size; i++) {
+        session_t* s = t->buckets[i];
+
+        while (s) {
+            session_t* next = s->next;
+            size_t b = session_hash(&s->client, s->id) & (size - 1);
+
+            s->next = buckets[b];
+            buckets[b] = s;
+            s = next;
+        }
+    }
+
+    free(t->buckets);
+    t->buckets = buckets;
+    t->size = size;
+}
+
+/* take the session out of the activity list */
+static void session_unlink(session_table_t* t, session_t* s) {
+    if (s->older)
+        s->older->newer = s->newer;
+    else
+        t->oldest = s->newer;
+
+    if (s->newer)
+        s->newer->older = s->older;
+    else
+        t->newest = s->older;
+
+    s->older = s->newer = NULL;
+}
+
+/* append the session to the activity list as the most recently active */
+static void session_append(session_table_t* t, session_t* s) {
+    s->older = t->newest;
+    s->newer = NULL;
+
+    if (t->newest)
+        t->newest->newer = s;
+    else
+        t->oldest = s;
+
+    t->newest = s;
+}
+
+bool sessions_init(session_table_t* t) {
+    memset(t, 0, sizeof(session_table_t));
+    t->size = SESSION_BUCKETS;
+    t->buckets = calloc(t->size, sizeof(session_t*));
+
+    return t->buckets != NULL;
+}
+
+session_t* session_find(session_table_t* t, struct sockaddr_in* client,
+    uint32_t id) {
+    session_t* s = t->buckets[session_hash(client, id) & (t->size - 1)];
+
+    while (s && !session_match(s, client, id))
+        s = s->next;
+
+    return s;
+}
+
+session_t* session_add(session_table_t* t, struct sockaddr_in* client,
+    uint32_t id) {
+    session_t* s = calloc(1, sizeof(session_t));
+
+    if (!s)
+        return NULL;
+
+    s->rwin.received = calloc(WINDOW_MAX, sizeof(bool));
+    s->rwin.held = calloc(WINDOW_MAX, sizeof(held_payload_t));
+
+    if (!s->rwin.received || !s->rwin.held) {
+        free(s->rwin.received);
+        free(s->rwin.held);
+        free(s);
+        return NULL;
+    }
+
+    memcpy(&s->client, client, sizeof(struct sockaddr_in));
+    s->id = id;
+    s->out_fd = -1;
+    s->delta.basis_fd = -1;
+    s->journal_fd = -1;
+    s->rwin.last_sq = -1;
+    s->first_seg = true;
+    xxh64_init(&s->digest, 0);
+
+    if (t->count >= t->size)
+        sessions_grow(t);
+
+    size_t b = session_hash(client, id) & (t->size - 1);
+    s->next = t->buckets[b];
+    t->buckets[b] = s;
+    t->count++;
+    session_append(t, s);
+
+    return s;
+}
+
+void session_touch(session_table_t* t, session_t* s, long long now) {
+    s->last_active = now;
+
+    if (t->newest != s) {
+        session_unlink(t, s);
+        session_append(t, s);
+    }
+}
+
+void session_remove(session_table_t* t, session_t* s) {
+    session_t** p = &t->buckets[session_hash(&s->client, s->id) &
+        (t->size - 1)];
+
+    while (*p && *p != s)
+        p = &(*p)->next;
+
+    if (*p)
+        *p = s->next;
+
+    session_unlink(t, s);
+    t->count--;
+    tree_free(&s->tree);
+
+    if (s->delta.basis_fd >= 0)
+        close(s->delta.basis_fd);
+
+    if (s->journal_fd >= 0)
+        close(s->journal_fd);
+
+    for (int i = 0; s->rwin.fec && i < WINDOW_MAX; i++)
+        fec_drop(&s->rwin.fec[i]);
+
+    free(s->rwin.fec);
+    free(s->rwin.held_buf);
+    free(s->rwin.held);
+    free(s->rwin.received);
+    free(s);
+}
+
+void sessions_free(session_table_t* t) {
+    while (t->oldest)
+        session_remove(t, t->oldest);
+
+    free(t->buckets);
+    t->buckets = NULL;
+}
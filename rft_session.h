@@ -0,0 +1,158 @@
+#ifndef _RFT_SESSION_H
+#define _RFT_SESSION_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h> // for sockaddr_in
+#include "rft_util.h"
+#include "rft_tree.h"
+#include "rft_csum.h"
+#include "rft_fec.h"
+#include "rft_delta.h"
+#include "rft_journal.h"
+
+#define SESSION_BUCKETS 64  // initial size of the session hash table
+#define SESSION_IDLE_USEC 30000000
+                            // time after the last segment of a session
+                            // before the server drops it
+#define CLOSE_BATCH 64      // files of a directory transfer written to the
+                            // end before the server waits for their writes
+                            // and closes them
+
+/*
+ * Session table of the server.
+ *
+ * Each transfer is a session identified by the address and port of the
+ * client and the session id the client puts in every segment. The server
+ * looks the session of each segment up in a hash table (constant time, the
+ * table doubles when there are more sessions than buckets) and keeps the
+ * sessions in order of their last segment, so the idle ones are found at
+ * the head of the list without scanning the table.
+ */
+
+/* copy of the payload of a segment received out of order */
+typedef struct held_payload {
+    char* data;             // the payload in the slot of the segment in 
+                            // held_buf, NULL if none is held
+    size_t len;             // bytes of the payload
+} held_payload_t;
+
+/*
+ * receive window of a session: the segments received out of order above
+ * the cumulative ACK point. Each segment is written to the file at its
+ * offset when it arrives, the window only tracks what to ACK and holds a
+ * copy of the payloads the digest of the session has not got to yet
+ */
+typedef struct recv_window {
+    int base;               // sq of the first segment not received yet
+    int last_sq;            // sq of the last segment (-1 until it is received)
+    int payload_size;       // payload size agreed with the client
+    off_t start;            // file offset of the range the session sends
+    off_t end;              // file offset of the end of the range
+    bool* received;         // segment sq (sq % WINDOW_MAX) was received
+    held_payload_t* held;   // payload of segment sq (sq % WINDOW_MAX) if
+                            // it was received above base, hashed once 
+                            // base gets to it
+    char* held_buf;         // room for the payload of each slot, WINDOW_MAX
+                            // slots of payload_size bytes
+    long dups;              // segments received again and ignored
+    int ahead;              // segments received above base
+    int ack_every;          // data segments in sequence per ACK agreed
+                            // with the client
+    int unacked;            // data segments received since the last ACK
+    int ack_sq;             // sq of the last data segment received, the
+                            // sq of the next ACK
+    fec_block_t* fec;       // blocks of segments XORed with their parity,
+                            // by the sq of their first segment 
+                            // (% WINDOW_MAX), NULL without FEC
+    long parity;            // parity segments received
+    long recovered;         // segments recovered from parity
+    long inflated;          // compressed segments decompressed
+    size_t packed_bytes;    // bytes of their compressed payloads
+    size_t raw_bytes;       // bytes of their payloads decompressed
+    long long inflate_usec; // time spent decompressing them
+} recv_window_t;
+
+/* a file transfer from a client */
+typedef struct session {
+    struct sockaddr_in client;  // address of the client
+    uint32_t id;                // session id chosen by the client
+    metadata_t file_inf;        // metadata agreed with the client
+    int out_fd;                 // output file, -1 once it is complete
+    recv_window_t rwin;         // receive state
+    bool first_seg;             // no data segment received yet
+    bool done;                  // all segments received and written
+    long long last_active;      // time of the last segment (usec)
+    long segs;                  // data segments received
+    xxh64_state_t digest;       // digest of the bytes received in sequence
+    bool verified;              // the client's digest was compared
+    tree_t tree;                // the files of a directory transfer, with
+                                // no entries until its manifest is received
+    delta_apply_t delta;        // the script of a delta transfer applied so
+                                // far to the server's copy of the file
+    int journal_fd;             // journal of the output file, -1 if the
+                                // client did not ask for one
+    uint64_t journaled;         // bytes of the range received in sequence
+                                // and recorded durable in the journal
+    size_t manifest_have;       // bytes of the manifest received
+    int closing[CLOSE_BATCH];   // entries of the tree written to the end,
+                                // still open
+    int nclosing;               // entries in closing
+    struct session* next;       // next session in the hash bucket
+    struct session* older;      // session with the previous last segment
+    struct session* newer;      // session with the next last segment
+} session_t;
+
+/* the sessions of a server */
+typedef struct session_table {
+    session_t** buckets;        // hash buckets, chains of sessions
+    size_t size;                // number of buckets (a power of 2)
+    size_t count;               // sessions in the table
+    session_t* oldest;          // least recently active session
+    session_t* newest;          // most recently active session
+} session_table_t;
+
+/*
+ * sessions_init - initialise an empty session table
+ *
+ * Return:
+ * False if the table could not be allocated
+ */
+bool sessions_init(session_table_t* t);
+
+/*
+ * session_find - the session of the given client and session id
+ *
+ * Return:
+ * The session or NULL if there is none
+ */
+session_t* session_find(session_table_t* t, struct sockaddr_in* client,
+    uint32_t id);
+
+/*
+ * session_add - add a new session of the given client and session id,
+ *      with an empty receive window, as the most recently active session
+ *
+ * Return:
+ * The session or NULL if it could not be allocated
+ */
+session_t* session_add(session_table_t* t, struct sockaddr_in* client,
+    uint32_t id);
+
+/*
+ * session_touch - make the session the most recently active, at time now
+ */
+void session_touch(session_table_t* t, session_t* s, long long now);
+
+/*
+ * session_remove - remove the session from the table and free it (its
+ *      output file must have been closed, the files of its tree, the
+ *      basis of its delta and its journal are closed)
+ */
+void session_remove(session_table_t* t, session_t* s);
+
+/*
+ * sessions_free - free the table and all sessions in it
+ */
+void sessions_free(session_table_t* t);
+
+#endif
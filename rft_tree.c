@@ -0,0 +1,317 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // strndup, O_DIRECTORY, O_NOFOLLOW
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rft_tree.h"
+
+/* append an entry with a copy of the path (len bytes) to the tree */
+static bool tree_add(tree_t* tree, const char* path, size_t len, off_t size,
+    mode_t mode) {
+    if (tree->count == tree->cap) {
+        int cap = tree->cap ? tree->cap * 2 : 64;
+        tree_entry_t* entries = realloc(tree->entries,
+            cap * sizeof(tree_entry_t));
+
+        if (!entries)
+            return false;
+
+        tree->entries = entries;
+        tree->cap = cap;
+    }
+
+    tree_entry_t* e = &tree->entries[tree->count];
+    memset(e, 0, sizeof(tree_entry_t));
+    e->path = strndup(path, len);
+    e->size = size;
+    e->mode = mode;
+    e->fd = -1;
+
+    if (!e->path)
+        return false;
+
+    tree->count++;
+
+    if (S_ISDIR(mode))
+        tree->dirs++;
+    else
+        tree->files++;
+
+    return true;
+}
+
+/*
+ * add what is in the directory at path (len bytes, "" for the root) below
+ * the root dirfd to the tree, the directories depth first
+ */
+static bool scan_dir(tree_t* tree, int dirfd, char* path, size_t len) {
+    int fd = openat(dirfd, len ? path : ".", O_RDONLY | O_DIRECTORY);
+    DIR* dir = fd >= 0 ? fdopendir(fd) : NULL;
+    struct dirent* de;
+    bool ok = true;
+
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+
+        return false;
+    }
+
+    while (ok && (de = readdir(dir))) {
+        size_t name_len = strlen(de->d_name);
+        struct stat st;
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        if (len + name_len + 2 > TREE_PATH_MAX) {
+            errno = ENAMETOOLONG;
+            ok = false;
+            break;
+        }
+
+        size_t sub_len = len;
+
+        if (len)
+            path[sub_len++] = '/';
+
+        memcpy(path + sub_len, de->d_name, name_len + 1);
+        sub_len += name_len;
+
+        if (fstatat(dirfd, path, &st, AT_SYMLINK_NOFOLLOW)) {
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            ok = tree_add(tree, path, sub_len, 0, st.st_mode) &&
+                scan_dir(tree, dirfd, path, sub_len);
+        } else if (S_ISREG(st.st_mode)) {
+            ok = tree_add(tree, path, sub_len, st.st_size, st.st_mode);
+        } else {
+            tree->skipped++;
+        }
+
+        path[len] = '\0';
+    }
+
+    closedir(dir);
+
+    return ok;
+}
+
+/*
+ * where the content of each entry starts in the stream: after the manifest
+ * and the content of the entries before it. False if the content is too
+ * large for a stream
+ */
+static bool tree_place(tree_t* tree) {
+    off_t offset = tree->manifest_bytes;
+
+    for (int i = 0; i < tree->count; i++) {
+        if (tree->entries[i].size > INT64_MAX - offset)
+            return false;
+
+        tree->entries[i].offset = offset;
+        offset += tree->entries[i].size;
+    }
+
+    tree->bytes = offset - tree->manifest_bytes;
+
+    return true;
+}
+
+bool tree_scan(tree_t* tree, int dirfd) {
+    char path[TREE_PATH_MAX] = "";
+
+    memset(tree, 0, sizeof(tree_t));
+
+    if (!scan_dir(tree, dirfd, path, 0))
+        return false;
+
+    /* encode the manifest */
+    size_t bytes = sizeof(manifest_hdr_t);
+    size_t path_bytes = 0;
+
+    for (int i = 0; i < tree->count; i++) {
+        size_t len = strlen(tree->entries[i].path);
+
+        bytes += sizeof(manifest_entry_t) + len;
+        path_bytes += len;
+    }
+
+    if (bytes > MANIFEST_MAX) {
+        errno = EFBIG;
+        return false;
+    }
+
+    tree->manifest = malloc(bytes);
+    tree->manifest_bytes = bytes;
+
+    if (!tree->manifest)
+        return false;
+
+    manifest_hdr_t hdr = { .entries = tree->count,
+        .path_bytes = path_bytes };
+    char* p = tree->manifest;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    for (int i = 0; i < tree->count; i++) {
+        tree_entry_t* e = &tree->entries[i];
+        manifest_entry_t me = { .size = e->size, .mode = e->mode,
+            .path_len = strlen(e->path) };
+
+        memcpy(p, &me, sizeof(me));
+        p += sizeof(me);
+        memcpy(p, e->path, me.path_len);
+        p += me.path_len;
+    }
+
+    return tree_place(tree);
+}
+
+bool tree_path_valid(const char* path, size_t len) {
+    if (!len || len >= TREE_PATH_MAX || memchr(path, '\0', len) ||
+            path[0] == '/')
+        return false;
+
+    /* no empty, . or .. component */
+    for (size_t i = 0; i <= len; ) {
+        const char* c = path + i;
+        const char* slash = memchr(c, '/', len - i);
+        size_t c_len = slash ? (size_t) (slash - c) : len - i;
+
+        if (!c_len || (c_len == 1 && c[0] == '.') ||
+                (c_len == 2 && c[0] == '.' && c[1] == '.'))
+            return false;
+
+        i += c_len + 1;
+    }
+
+    return true;
+}
+
+bool tree_parse(tree_t* tree) {
+    char* p = tree->manifest;
+    char* end = p + tree->manifest_bytes;
+    manifest_hdr_t hdr;
+
+    if (tree->manifest_bytes < sizeof(hdr))
+        return false;
+
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+
+    if (hdr.entries > (tree->manifest_bytes - sizeof(hdr)) /
+            sizeof(manifest_entry_t))
+        return false;
+
+    tree->entries = calloc(hdr.entries ? hdr.entries : 1,
+        sizeof(tree_entry_t));
+    tree->cap = hdr.entries;
+
+    if (!tree->entries)
+        return false;
+
+    for (uint32_t i = 0; i < hdr.entries; i++) {
+        manifest_entry_t me;
+
+        if ((size_t) (end - p) < sizeof(me))
+            return false;
+
+        memcpy(&me, p, sizeof(me));
+        p += sizeof(me);
+
+        if ((size_t) (end - p) < me.path_len ||
+                !tree_path_valid(p, me.path_len) || me.size < 0 ||
+                !(S_ISREG(me.mode) || (S_ISDIR(me.mode) && !me.size)))
+            return false;
+
+        if (!tree_add(tree, p, me.path_len, me.size, me.mode))
+            return false;
+
+        p += me.path_len;
+    }
+
+    return p == end && tree_place(tree);
+}
+
+bool tree_create(tree_t* tree, int dirfd) {
+    for (int i = 0; i < tree->count; i++) {
+        tree_entry_t* e = &tree->entries[i];
+
+        /* a directory stays writable until its files are written */
+        if (S_ISDIR(e->mode)) {
+            if (mkdirat(dirfd, e->path, S_IRWXU) && errno != EEXIST)
+                return false;
+        } else if (!e->size) {
+            if (tree_open(tree, i, dirfd, true) < 0)
+                return false;
+
+            close(e->fd);
+            e->fd = -1;
+        }
+    }
+
+    return true;
+}
+
+int tree_open(tree_t* tree, int i, int dirfd, bool create) {
+    tree_entry_t* e = &tree->entries[i];
+
+    if (!create) {
+        e->fd = openat(dirfd, e->path, O_RDONLY | O_NOFOLLOW);
+        return e->fd;
+    }
+
+    e->fd = openat(dirfd, e->path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+        S_IRUSR | S_IWUSR);
+
+    /* the mode only applies to later opens, the file stays writable */
+    if (e->fd >= 0)
+        fchmod(e->fd, e->mode & 07777);
+
+    return e->fd;
+}
+
+int tree_find(tree_t* tree, off_t offset) {
+    int lo = 0;
+    int hi = tree->count - 1;
+
+    /* the last entry that starts at or before the offset */
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+
+        if (tree->entries[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+void tree_finish(tree_t* tree, int dirfd) {
+    /* subdirectories first, a parent may take away write permission */
+    for (int i = tree->count - 1; i >= 0; i--) {
+        if (S_ISDIR(tree->entries[i].mode))
+            fchmodat(dirfd, tree->entries[i].path,
+                tree->entries[i].mode & 07777, 0);
+    }
+}
+
+void tree_free(tree_t* tree) {
+    for (int i = 0; i < tree->count; i++) {
+        if (tree->entries[i].fd >= 0)
+            close(tree->entries[i].fd);
+
+        free(tree->entries[i].path);
+    }
+
+    free(tree->entries);
+    free(tree->manifest);
+    memset(tree, 0, sizeof(tree_t));
+}
@@ -0,0 +1,133 @@
+#ifndef _RFT_TREE_H
+#define _RFT_TREE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define MANIFEST_MAX (64 * 1024 * 1024)
+                            // max bytes of the manifest of a directory tree
+#define TREE_PATH_MAX 4096  // max size of the path of a file in a tree
+
+/*
+ * Directory trees sent in one session.
+ *
+ * A directory is sent as one stream of bytes: a manifest of the files and
+ * directories in the tree (paths, sizes and modes) followed by the content
+ * of all files back to back, in the order of the manifest. The transfer
+ * sends the stream like the content of a single file, a segment may carry
+ * the end of one file and the start of the next, so there is no exchange
+ * and no segment per file and small files cost no more than their bytes
+ * and their entry in the manifest. The offset of a file in the stream
+ * follows from the sizes of the files before it.
+ *
+ * The manifest is a manifest_hdr_t followed by an entry per file or
+ * directory, a manifest_entry_t and the bytes of the path (without a
+ * terminating nul), packed without padding. Paths are relative to the root
+ * of the tree and each directory comes before what is in it.
+ */
+
+/* start of a manifest */
+typedef struct manifest_hdr {
+    uint32_t entries;       // entries in the manifest
+    uint32_t path_bytes;    // bytes of all paths
+} manifest_hdr_t;
+
+/* entry of a manifest, followed by path_len bytes of path */
+typedef struct manifest_entry {
+    int64_t size;           // bytes of the file, 0 for a directory
+    uint32_t mode;          // type and permissions (st_mode)
+    uint32_t path_len;      // bytes of the path
+} manifest_entry_t;
+
+/* a file or directory of a tree */
+typedef struct tree_entry {
+    char* path;             // path relative to the root of the tree
+    off_t size;             // bytes of the file, 0 for a directory
+    mode_t mode;            // type and permissions
+    off_t offset;           // offset of the content in the stream
+    int fd;                 // the file while it is open, else -1
+    off_t done;             // bytes of the content written (server)
+} tree_entry_t;
+
+/* the files and directories of a tree */
+typedef struct tree {
+    tree_entry_t* entries;
+    int count;              // entries in the tree
+    int cap;                // room for entries
+    int files;              // regular files in the tree
+    int dirs;               // directories in the tree (not the root)
+    long skipped;           // entries that are not sent (symbolic links,
+                            // devices, ...)
+    off_t bytes;            // bytes of the content of all files
+    char* manifest;         // the manifest
+    size_t manifest_bytes;  // bytes of the manifest, where the content of
+                            // the files starts in the stream
+} tree_t;
+
+/*
+ * tree_scan - list the files and directories below the open directory
+ *      dirfd and build the manifest of the tree
+ *
+ * Return:
+ * False if a directory could not be read, the manifest would be larger
+ *      than MANIFEST_MAX or memory could not be allocated
+ */
+bool tree_scan(tree_t* tree, int dirfd);
+
+/*
+ * tree_parse - take the entries of a tree from the complete manifest in
+ *      tree->manifest (tree->manifest_bytes bytes), rejecting paths that
+ *      are absolute or lead out of the tree
+ *
+ * Return:
+ * False if the manifest is invalid or memory could not be allocated
+ */
+bool tree_parse(tree_t* tree);
+
+/*
+ * tree_path_valid - check that path (len bytes) is relative and stays 
+ *      below the directory it is taken in: not absolute and without an 
+ *      empty, . or .. component
+ *
+ * Return:
+ * True if the path is valid
+ */
+bool tree_path_valid(const char* path, size_t len);
+
+/*
+ * tree_create - create the directories and empty files of the tree below
+ *      the open directory dirfd, the other files are created when their
+ *      content arrives
+ *
+ * Return:
+ * False if an entry could not be created
+ */
+bool tree_create(tree_t* tree, int dirfd);
+
+/*
+ * tree_open - open entry i of the tree below the open directory dirfd:
+ *      create it for writing if create is set, else open it for reading
+ *
+ * Return:
+ * The file descriptor, also kept in the entry, or -1
+ */
+int tree_open(tree_t* tree, int i, int dirfd, bool create);
+
+/*
+ * tree_find - the entry of the tree with the content at the given offset
+ *      of the stream (at or after the end of the manifest)
+ */
+int tree_find(tree_t* tree, off_t offset);
+
+/*
+ * tree_finish - set the modes of the directories of the tree below the
+ *      open directory dirfd, once all files are written in them
+ */
+void tree_finish(tree_t* tree, int dirfd);
+
+/*
+ * tree_free - close the open files of the tree and free it
+ */
+void tree_free(tree_t* tree);
+
+#endif
@@ -3,22 +3,38 @@
 #include <errno.h>
 #include "rft_util.h"
 #include <stdlib.h>
+#include <time.h>
 
 
-/* Utility functions - do NOT edit this file */
+/* Utility functions of the client and the server */
 
-int checksum(char* payload, bool is_corrupted) {
+int checksum(char* payload, size_t len, bool is_corrupted) {
     if (is_corrupted)
         return -rand();
     
     int sum = 0;
     
-    for (int i = 0; i < PAYLOAD_SIZE; i++)
+    for (size_t i = 0; i < len; i++)
         sum += payload[i];
 
     return sum;
 }
 
+void sack_set(char* sack, int i) {
+    sack[i / 8] |= 1 << (i % 8);
+}
+
+bool sack_isset(char* sack, int i) {
+    return sack[i / 8] & (1 << (i % 8));
+}
+
+long long now_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void print_sep() {
     printf("----------------------------------------------------------"
             "---------------------\n");
@@ -1,43 +1,173 @@
 #ifndef _RFT_H
 #define _RFT_H
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #define FILE_NAME_SIZE 56   // max size of a file name (length if 55)
-#define PAYLOAD_SIZE 36     // max size of file content payload to send in 
-                            // each segment (36 bytes, length of string: 35)
+#define PAYLOAD_SIZE 36     // min size of file content payload to send in 
+                            // each segment
+#define PAYLOAD_SIZE_DEFAULT 1400
+                            // payload size the client proposes unless set
+                            // on the command line (fits a 1500 byte MTU)
+#define DGRAM_SIZE_MAX 65507
+                            // max size of a UDP datagram over IPv4
 #define INF_MSG_SIZE 256    // max size of information messages to print out
 #define PORT_MIN 1025       // minimum network port number to use
 #define PORT_MAX 65535      // maximum network port number to use
+#define WINDOW_SIZE 64      // default number of unacknowledged segments the
+                            // client keeps in flight (wt transfer mode)
+#define WINDOW_MAX 1024     // max send window of the client and size of the
+                            // server's receive window (in segments)
+#define SACK_BITS WINDOW_MAX
+                            // segments above the cumulative ACK reported in
+                            // the selective ACK bitmap of an ACK segment
+#define META_TIMEOUT_USEC 1000000
+                            // time to wait for the server's reply to the 
+                            // metadata before sending it again
+#define META_RETRIES 5      // max times the client sends the metadata
+#define PROBE_TIMEOUT_USEC 250000
+                            // time to wait for the echo of a path MTU probe
+#define PROBE_RETRIES 2     // max times the client sends a path MTU probe
+#define DIGEST_TIMEOUT_USEC 1000000
+                            // time to wait for the server's digest of the
+                            // transfer before sending the client's again
+#define DIGEST_RETRIES 5    // max times the client sends its digest
+#define DELTA_TIMEOUT_USEC 500000
+                            // time to wait for the signatures of the 
+                            // server's copy of a file before asking again
+#define DELTA_RETRIES 5     // max times the client asks for signatures 
+                            // without getting any
+#define RESUME_TIMEOUT_USEC 500000
+                            // time to wait for the ranges of a file the
+                            // server has on disk before asking again
+#define RESUME_RETRIES 5    // max times the client asks for the ranges
+#define SOCK_BUF_SIZE (8 * 1024 * 1024)
+                            // socket buffer size requested to queue a full 
+                            // window of large segments
+#define BATCH_SIZE 16       // default max datagrams sent or received with
+                            // one sendmmsg/recvmmsg call
+#define BATCH_MAX 64        // max datagrams per sendmmsg/recvmmsg call
+#define ACK_EVERY_MAX 16    // max data segments in sequence per ACK
 
 /* metadata to send to prepare for a file transfer */
 typedef struct metadata {
     off_t size;                 // size of the file to send
+    int payload_size;           // max bytes of segment payloads:
+                                // proposed by the client, agreed by the 
+                                // server in its reply
     char name[FILE_NAME_SIZE];  // name of the file to create on server
+    off_t range_offset;         // file offset of the range of the file the
+                                // session sends (0 for the whole file)
+    off_t range_bytes;          // bytes in the range (size for the whole 
+                                // file), parallel streams send a file as
+                                // ranges, a session each
+    off_t manifest_bytes;       // bytes of the manifest at the start of the
+                                // data when a directory tree is sent (the
+                                // name is the directory to create), 0 when
+                                // a file is sent
+    int csum;                   // checksum algorithm of data segments 
+                                // (csum_type): proposed by the client, 
+                                // agreed by the server in its reply
+    int fec;                    // blocks of data segments are followed by
+                                // parity segments (1) or not (0): 
+                                // proposed by the client, agreed by the
+                                // server in its reply
+    int compress;               // payloads of data segments may be 
+                                // compressed (1) or not (0): proposed by
+                                // the client, agreed by the server in its 
+                                // reply
+    int delta_block;            // bytes per block of the signatures of the
+                                // server's copy of the file when the data
+                                // is a delta script against it (range_bytes
+                                // is the size of the script, see 
+                                // rft_delta.h), 0 when the file is sent
+    uint64_t source;            // identity of the version of the file when
+                                // the server is to keep a journal of the 
+                                // bytes of it on disk to resume the 
+                                // transfer from (see rft_journal.h), 0 for
+                                // none: proposed by the client, agreed by
+                                // the server in its reply
+    int ack_every;              // max data segments received in sequence
+                                // the server ACKs at once: proposed by the
+                                // client (1 to ACK each segment), agreed 
+                                // by the server in its reply
 } metadata_t;
 
 /* segment types */
 typedef enum {
   DATA_SEG,    // data segment
-  ACK_SEG      // ack segment
+  ACK_SEG,     // ack segment
+  META_SEG,    // metadata segment (payload is a metadata_t), sent by the 
+               // client to start a transfer and echoed by the server with
+               // the agreed settings
+  PROBE_SEG,   // path MTU probe padded to the size to test, echoed by the
+               // server without payload
+  DIGEST_SEG,  // digest of the bytes of the transfer (payload is a 
+               // digest_t), sent by the client once all segments are ACKed
+               // and answered by the server with its own digest
+  FEC_SEG,     // parity of a block of data segments (payload is the XOR of
+               // their payloads), not ACKed (see rft_fec.h)
+  DELTA_SEG,   // request for the signatures of the blocks of the server's
+               // copy of a file (payload is a delta_req_t) and the reply 
+               // (a delta_sigs_t), outside of any session (see rft_delta.h)
+  RESUME_SEG   // request for the ranges of a file the server has on disk
+               // (payload is a resume_req_t) and the reply (a resume_t),
+               // outside of any session (see rft_journal.h)
 } seg_type;
 
-/* segment definition for chunks of file transfer data */
+/* digest of the bytes of a transfer, compared at its end */
+typedef struct digest {
+    uint64_t digest;            // xxHash64 of the bytes, in offset order
+    off_t bytes;                // bytes hashed
+} digest_t;
+
+/* 
+ * segment definition for chunks of file transfer data: a fixed header 
+ * followed by payload_bytes of payload. Only the header and the payload 
+ * bytes used are sent. Payloads are binary, payload_bytes is their length.
+ * The session id comes first so that it is at the start of every datagram.
+ */
 typedef struct segment {
+    uint32_t session;               // session id chosen by the client, the
+                                    // server tells transfers apart by it
     int sq;                         // sequence number of segment
     seg_type type;                  // segment type
     bool last;                      // last segment flag
+    bool compressed;                // payload is compressed (rft_lz.h), 
+                                    // payload_bytes is its compressed size
+                                    // (DATA_SEG)
+    bool ack_now;                   // the sender waits for the ACK of the
+                                    // segment to send more, the server ACKs
+                                    // it without delay (DATA_SEG)
     int checksum;                   // checksum of payload
-    size_t payload_bytes;           // bytes of payload (not incl. '\0')
-    char payload[PAYLOAD_SIZE];     // payload data (file content in chunks)
+    int ack;                        // cumulative ACK: sq of the next segment 
+                                    // expected in sequence (ACK_SEG), with
+                                    // FEC the sq of the first segment of
+                                    // the block (DATA_SEG) or the segments
+                                    // in the block (FEC_SEG)
+    size_t payload_bytes;           // bytes of payload
+    off_t offset;                   // file offset of the payload (DATA_SEG),
+                                    // of the first segment of the block
+                                    // (FEC_SEG) or segments of the session
+                                    // recovered from parity (ACK_SEG)
+    char payload[];                 // payload data (file content in chunks)
+                                    // or, for ACK_SEG, the selective ACK 
+                                    // bitmap: bit i set if segment 
+                                    // ack + 1 + i was received
 } segment_t;
 
+#define PAYLOAD_SIZE_MAX ((int) (DGRAM_SIZE_MAX - sizeof(segment_t)))
+                            // max payload size of a segment
+#define ACK_SIZE (sizeof(segment_t) + SACK_BITS / 8)
+                            // max size of an ACK segment
 
 /*
  * checksum - calculates a checksum from a segment's payload data
  *
  * Parameters:
  * payload - a pointer to the payload
+ * len - the number of payload bytes
  * is_corrupted - a flag to indicate whether the checksum should be corrupted
  *      to simulate a network error (set for true in some cases for Part 2 of
  *      the assignment)
@@ -45,7 +175,20 @@ typedef struct segment {
  * Return:
  * An integer value calculated from the payload of a segment
  */
-int checksum(char *payload, bool is_corrupted);
+int checksum(char *payload, size_t len, bool is_corrupted);
+
+/*
+ * sack_set, sack_isset - set and test bit i of the selective ACK bitmap 
+ *      carried in the payload of an ACK segment
+ */
+void sack_set(char* sack, int i);
+bool sack_isset(char* sack, int i);
+
+/*
+ * now_usec - current time of a monotonic clock in microseconds, for
+ *      measuring timeouts
+ */
+long long now_usec();
 
 /* 
  * Information message functions 
@@ -0,0 +1,362 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // syscall
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "rft_writer.h"
+
+/* write len bytes of buf at the given offset, however many writes it takes */
+static bool write_at(int fd, char* buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n <= 0)
+            return false;
+
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+/*
+ * keep the failed write of a buffer until the server takes it, once per 
+ * file: the transfer of a file is given up whichever of its writes failed
+ */
+static void write_failed(file_writer_t* wr, write_req_t* req, int error) {
+    req->error = error;
+
+    for (int i = 0; i < wr->nfailed; i++) {
+        if (wr->failed[i].fd == req->fd)
+            return;
+    }
+
+    if (wr->nfailed == wr->failed_room) {
+        int room = wr->failed_room ? wr->failed_room * 2 : WRITER_DEPTH;
+        write_req_t* grown = realloc(wr->failed, room * sizeof(write_req_t));
+
+        if (!grown) {
+            if (!wr->error)
+                wr->error = ENOMEM;
+
+            return;
+        }
+
+        wr->failed = grown;
+        wr->failed_room = room;
+    }
+
+    wr->failed[wr->nfailed++] = *req;
+}
+
+/* unmap the rings and close the io_uring instance, back to pwrite mode */
+static void ring_release(file_writer_t* wr) {
+    if (wr->sqes)
+        munmap(wr->sqes, wr->sqes_size);
+
+    if (wr->cq_ring && wr->cq_ring != wr->sq_ring)
+        munmap(wr->cq_ring, wr->cq_ring_size);
+
+    if (wr->sq_ring)
+        munmap(wr->sq_ring, wr->sq_ring_size);
+
+    if (wr->ring_fd >= 0)
+        close(wr->ring_fd);
+
+    wr->sqes = wr->cq_ring = wr->sq_ring = NULL;
+    wr->ring_fd = -1;
+}
+
+/* map a ring of the io_uring instance, NULL on failure */
+static void* ring_map(int ring_fd, size_t size, off_t offset) {
+    void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+/*
+ * set up an io_uring instance with room for WRITER_DEPTH writes and
+ * register the buffers of the writer with it, false if io_uring is not
+ * available
+ */
+static bool ring_setup(file_writer_t* wr) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    wr->ring_fd = syscall(__NR_io_uring_setup, WRITER_DEPTH, &p);
+
+    if (wr->ring_fd < 0)
+        return false;
+
+    wr->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    wr->cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    wr->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* newer kernels map both rings with one mmap */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (wr->cq_ring_size > wr->sq_ring_size)
+            wr->sq_ring_size = wr->cq_ring_size;
+
+        wr->sq_ring = ring_map(wr->ring_fd, wr->sq_ring_size,
+            IORING_OFF_SQ_RING);
+        wr->cq_ring = wr->sq_ring;
+    } else {
+        wr->sq_ring = ring_map(wr->ring_fd, wr->sq_ring_size,
+            IORING_OFF_SQ_RING);
+        wr->cq_ring = ring_map(wr->ring_fd, wr->cq_ring_size,
+            IORING_OFF_CQ_RING);
+    }
+
+    wr->sqes = ring_map(wr->ring_fd, wr->sqes_size, IORING_OFF_SQES);
+
+    if (!wr->sq_ring || !wr->cq_ring || !wr->sqes ||
+            syscall(__NR_io_uring_register, wr->ring_fd,
+                IORING_REGISTER_BUFFERS, wr->iov, WRITER_DEPTH)) {
+        ring_release(wr);
+        return false;
+    }
+
+    char* sq = wr->sq_ring;
+    char* cq = wr->cq_ring;
+    wr->sq_head = (unsigned*) (sq + p.sq_off.head);
+    wr->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    wr->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    wr->sq_array = (unsigned*) (sq + p.sq_off.array);
+    wr->cq_head = (unsigned*) (cq + p.cq_off.head);
+    wr->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    wr->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    wr->cqes = cq + p.cq_off.cqes;
+
+    return true;
+}
+
+/* queue the (rest of the) write in buffer i on the submission ring */
+static void ring_queue(file_writer_t* wr, int i) {
+    write_req_t* req = &wr->reqs[i];
+    unsigned tail = *wr->sq_tail;
+    unsigned index = tail & *wr->sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*) wr->sqes + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = req->fd;
+    sqe->addr = (unsigned long) (wr->bufs + i * wr->buf_size + req->done);
+    sqe->len = req->len;
+    sqe->off = req->offset;
+    sqe->buf_index = i;
+    sqe->user_data = i;
+    wr->sq_array[index] = index;
+
+    /* the kernel must see the entry before the new tail */
+    __atomic_store_n(wr->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    wr->queued++;
+}
+
+/*
+ * submit the queued writes and, if wait is set, wait for at least one write
+ * to complete; false on an error of the system call
+ */
+static bool ring_enter(file_writer_t* wr, bool wait) {
+    int n = syscall(__NR_io_uring_enter, wr->ring_fd, wr->queued, wait ? 1 : 0,
+        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return true;
+
+        if (!wr->error)
+            wr->error = errno;
+
+        return false;
+    }
+
+    if (n > 0) {
+        wr->submits++;
+        wr->submitted += n;
+        wr->queued -= n;
+        wr->inflight += n;
+
+        if (wr->inflight > wr->max_inflight)
+            wr->max_inflight = wr->inflight;
+    }
+
+    return true;
+}
+
+/*
+ * take the completed writes off the completion ring: the buffer of a write
+ * done is free again, the rest of a short write is queued again
+ */
+static void ring_reap(file_writer_t* wr) {
+    unsigned head = *wr->cq_head;
+    unsigned tail = __atomic_load_n(wr->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe =
+            (struct io_uring_cqe*) wr->cqes + (head & *wr->cq_mask);
+        int i = cqe->user_data;
+        write_req_t* req = &wr->reqs[i];
+        int res = cqe->res;
+
+        head++;
+        wr->inflight--;
+
+        if (res == -EINTR || res == -EAGAIN) {
+            ring_queue(wr, i);
+        } else if (res > 0 && (size_t) res < req->len) {
+            req->done += res;
+            req->len -= res;
+            req->offset += res;
+            ring_queue(wr, i);
+        } else {
+            if (res <= 0)
+                write_failed(wr, req, res < 0 ? -res : EIO);
+
+            wr->free[wr->nfree++] = i;
+        }
+    }
+
+    __atomic_store_n(wr->cq_head, head, __ATOMIC_RELEASE);
+}
+
+bool writer_open(file_writer_t* wr, size_t buf_size, bool use_uring) {
+    memset(wr, 0, sizeof(file_writer_t));
+    wr->ring_fd = -1;
+    wr->buf_size = buf_size;
+    wr->bufs = malloc(WRITER_DEPTH * buf_size);
+    wr->iov = calloc(WRITER_DEPTH, sizeof(struct iovec));
+    wr->reqs = calloc(WRITER_DEPTH, sizeof(write_req_t));
+    wr->free = calloc(WRITER_DEPTH, sizeof(int));
+
+    if (!wr->bufs || !wr->iov || !wr->reqs || !wr->free) {
+        writer_close(wr);
+        return false;
+    }
+
+    for (int i = 0; i < WRITER_DEPTH; i++) {
+        wr->iov[i].iov_base = wr->bufs + i * buf_size;
+        wr->iov[i].iov_len = buf_size;
+        wr->free[wr->nfree++] = WRITER_DEPTH - 1 - i;
+    }
+
+    if (use_uring)
+        ring_setup(wr);
+
+    return true;
+}
+
+char* writer_buf(file_writer_t* wr) {
+    if (wr->error)
+        return NULL;
+
+    /* pwrite mode writes a buffer before the next is needed */
+    if (wr->ring_fd < 0)
+        return wr->bufs;
+
+    /* backpressure: all buffers in flight, wait for the disk */
+    if (!wr->nfree) {
+        wr->waits++;
+
+        while (!wr->nfree && !wr->error) {
+            if (!ring_enter(wr, true))
+                return NULL;
+
+            ring_reap(wr);
+        }
+
+        if (wr->error)
+            return NULL;
+    }
+
+    int i = wr->free[--wr->nfree];
+
+    return wr->bufs + i * wr->buf_size;
+}
+
+void writer_write(file_writer_t* wr, int fd, char* buf, size_t len, 
+    off_t offset) {
+    int i = (buf - wr->bufs) / wr->buf_size;
+    write_req_t* req = &wr->reqs[i];
+
+    wr->writes++;
+    req->fd = fd;
+    req->len = len;
+    req->offset = offset;
+    req->done = 0;
+    req->error = 0;
+
+    if (wr->ring_fd < 0) {
+        if (!write_at(fd, buf, len, offset))
+            write_failed(wr, req, errno ? errno : EIO);
+
+        return;
+    }
+
+    ring_queue(wr, i);
+}
+
+bool writer_submit(file_writer_t* wr) {
+    if (wr->ring_fd >= 0) {
+        if (wr->queued)
+            ring_enter(wr, false);
+
+        ring_reap(wr);
+    }
+
+    return !wr->error;
+}
+
+bool writer_sync(file_writer_t* wr) {
+    while (wr->ring_fd >= 0 && (wr->queued || wr->inflight)) {
+        if (!ring_enter(wr, wr->inflight > 0))
+            break;
+
+        ring_reap(wr);
+    }
+
+    return !wr->error;
+}
+
+bool writer_failed(file_writer_t* wr, write_req_t* req) {
+    if (!wr->nfailed)
+        return false;
+
+    *req = wr->failed[--wr->nfailed];
+
+    return true;
+}
+
+bool writer_close(file_writer_t* wr) {
+    /* the kernel still uses the buffers of writes in flight */
+    writer_sync(wr);
+    ring_release(wr);
+    free(wr->bufs);
+    free(wr->iov);
+    free(wr->reqs);
+    free(wr->free);
+    free(wr->failed);
+    wr->bufs = NULL;
+    wr->iov = NULL;
+    wr->reqs = NULL;
+    wr->free = NULL;
+    wr->failed = NULL;
+    wr->nfailed = 0;
+
+    if (wr->error) {
+        errno = wr->error;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,150 @@
+#ifndef _RFT_WRITER_H
+#define _RFT_WRITER_H
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define WRITER_DEPTH 64     // max writes in flight (io_uring mode)
+
+/*
+ * Asynchronous writer of the server's output files.
+ *
+ * The server copies each payload into a buffer of the writer and queues its
+ * write at the payload's offset in the output file of its session, one 
+ * writer serves all the sessions of the server. In io_uring mode the 
+ * buffers are registered with the kernel once (fixed buffers) and the 
+ * writes queued while a batch of segments is processed are submitted with
+ * one system call, which also reaps the writes that completed, so a slow 
+ * disk does not stop the server from draining the socket. The writer only
+ * waits for the disk when all WRITER_DEPTH buffers are in flight 
+ * (backpressure). Where io_uring is not available (old kernel, disabled by
+ * the system) the writer falls back to writing each payload with pwrite 
+ * when it is queued.
+ *
+ * A write that fails does not stop the writer: the failed write is kept, 
+ * one per file, until the server takes it with writer_failed and gives up
+ * the transfer the file belongs to. Only the io_uring system call failing
+ * stops the writer.
+ */
+
+/* a write in flight in a buffer of the writer */
+typedef struct write_req {
+    int fd;                 // file to write to
+    size_t len;             // bytes still to write
+    off_t offset;           // file offset to write them at
+    size_t done;            // bytes of the buffer already written
+    int error;              // errno of the write if it failed, else 0
+} write_req_t;
+
+/* writer of open files */
+typedef struct file_writer {
+    int ring_fd;            // io_uring instance (io_uring mode), else -1
+    size_t buf_size;        // bytes of each buffer
+    char* bufs;             // the buffers, WRITER_DEPTH of them
+    struct iovec* iov;      // the buffers as registered with the kernel
+    write_req_t* reqs;      // the write in each buffer
+    int* free;              // stack of the indices of free buffers
+    int nfree;              // free buffers
+    int queued;             // writes queued but not submitted yet
+    int inflight;           // writes submitted and not completed yet
+    write_req_t* failed;    // failed writes not taken yet, one per file
+    int nfailed;            // failed writes not taken yet
+    int failed_room;        // failed writes there is room for
+    int error;              // errno of the failed io_uring system call
+                            // (or ENOMEM if a failed write could not be
+                            // kept), else 0
+
+    /* the rings shared with the kernel (io_uring mode) */
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    void* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void* cqes;
+
+    /* statistics */
+    long writes;            // writes queued
+    long submits;           // system calls that submitted writes
+    long submitted;         // writes submitted
+    long waits;             // waits for a free buffer (backpressure)
+    int max_inflight;       // queue depth achieved
+} file_writer_t;
+
+/*
+ * writer_open - initialise a writer with buffers of buf_size bytes, using 
+ *      io_uring if use_uring is set. If io_uring cannot be set up the writer
+ *      falls back to pwrite mode.
+ *
+ * Parameters:
+ * wr - the writer to initialise
+ * buf_size - the max bytes of a write
+ * use_uring - write through io_uring rather than with pwrite
+ *
+ * Return:
+ * True on success, false if the buffers could not be allocated
+ */
+bool writer_open(file_writer_t* wr, size_t buf_size, bool use_uring);
+
+/*
+ * writer_buf - a free buffer of the writer to copy the bytes of a write
+ *      into, waiting for a write in flight to complete if there is none
+ *
+ * Return:
+ * The buffer or NULL if the writer failed
+ */
+char* writer_buf(file_writer_t* wr);
+
+/*
+ * writer_write - queue the write of len bytes of buf (from writer_buf) at
+ *      the given offset of the open file fd. In pwrite mode the bytes are 
+ *      written at once. If the write fails it is kept for writer_failed.
+ */
+void writer_write(file_writer_t* wr, int fd, char* buf, size_t len, 
+    off_t offset);
+
+/*
+ * writer_submit - submit the queued writes to the kernel and take the
+ *      completed ones, without waiting for any
+ *
+ * Return:
+ * False if the writer failed
+ */
+bool writer_submit(file_writer_t* wr);
+
+/*
+ * writer_sync - submit the queued writes and wait for all writes to 
+ *      complete, so that a file written to can be closed
+ *
+ * Return:
+ * False if the writer failed
+ */
+bool writer_sync(file_writer_t* wr);
+
+/*
+ * writer_failed - take a failed write: its fd and error say which file 
+ *      could not be written and why. The failed writes of a file must be
+ *      taken before it is closed, its fd may be reused.
+ *
+ * Return:
+ * True if a failed write was taken into req, false if there is none
+ */
+bool writer_failed(file_writer_t* wr, write_req_t* req);
+
+/*
+ * writer_close - wait for all queued writes to complete and release the
+ *      resources of the writer (the files written to are left open)
+ *
+ * Return:
+ * False if the writer failed, errno is set to its error
+ */
+bool writer_close(file_writer_t* wr);
+
+#endif